@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -57,4 +58,24 @@ inline std::vector<std::uint8_t> Base64_decode(std::string encoded_string)
     return ret;
 }
 
+inline std::string Base64_encode(const std::vector<std::uint8_t>& data)
+{
+    std::string ret;
+    ret.reserve(4 * ((data.size() + 2) / 3));
+    for (size_t i = 0; i < data.size(); i += 3)
+    {
+        // Missing bytes at the end are padded with '=' characters
+        const size_t n = std::min<size_t>(3, data.size() - i);
+        const std::uint8_t b3[3] = {
+            data[i],
+            static_cast<std::uint8_t>(n > 1 ? data[i+1] : 0),
+            static_cast<std::uint8_t>(n > 2 ? data[i+2] : 0)};
+        ret.push_back(to_base64[(b3[0] & 0xfc) >> 2]);
+        ret.push_back(to_base64[((b3[0] & 0x03) << 4) + ((b3[1] & 0xf0) >> 4)]);
+        ret.push_back(n > 1 ? to_base64[((b3[1] & 0x0f) << 2) + ((b3[2] & 0xc0) >> 6)] : '=');
+        ret.push_back(n > 2 ? to_base64[b3[2] & 0x3f] : '=');
+    }
+    return ret;
+}
+
 } } // namespace fdeep, namespace internal
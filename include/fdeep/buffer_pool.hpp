@@ -0,0 +1,242 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+namespace fdeep { namespace internal
+{
+
+// Counters of a buffer_pool, counted only while it is enabled.
+// hits_: Allocations served with a block freed before.
+// misses_: Allocations that needed a new block.
+// retained_bytes_: Memory of the freed blocks kept for reuse.
+struct buffer_pool_stats
+{
+    std::size_t hits_;
+    std::size_t misses_;
+    std::size_t retained_bytes_;
+};
+
+// Keeps freed memory blocks to hand them out again, so a forward pass
+// repeating the allocations of the previous one does not need new memory.
+// Blocks are grouped by size class. Between two powers of two there are
+// four classes, so a block is at most 25% larger than requested.
+// Every class has its own lock, so threads allocating blocks
+// of different sizes do not wait for each other.
+// With max_retained_bytes == 0 the pool is disabled: Blocks are allocated
+// with exactly the requested size and freed right away.
+// All blocks start at a multiple of the given alignment (below 128).
+// Uses the global operator new/delete for the underlying blocks.
+class buffer_pool
+{
+public:
+    buffer_pool(std::size_t alignment, std::size_t max_retained_bytes) :
+        alignment_(alignment),
+        max_retained_bytes_(max_retained_bytes),
+        retained_bytes_(0),
+        hits_(0),
+        misses_(0),
+        size_classes_()
+    {
+        if (alignment_ == 0 || alignment_ >= pooled_flag)
+        {
+            throw std::invalid_argument("invalid alignment");
+        }
+    }
+    ~buffer_pool()
+    {
+        clear();
+    }
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    void* allocate(std::size_t bytes)
+    {
+        const bool pooled = max_retained_bytes_ > 0 && bytes <= max_pooled_size;
+        if (pooled && retained_bytes_ > 0)
+        {
+            size_class_blocks& blocks = size_classes_[size_class_index(bytes)];
+            std::lock_guard<std::mutex> lock(blocks.mutex_);
+            if (!blocks.blocks_.empty())
+            {
+                void* const result = blocks.blocks_.back();
+                blocks.blocks_.pop_back();
+                retained_bytes_ -= size_class(bytes);
+                ++hits_;
+                return result;
+            }
+        }
+        if (pooled)
+        {
+            ++misses_;
+        }
+        // The distance to the start of the underlying block, and whether
+        // it has the size of a size class, is stored in the byte
+        // in front of the aligned memory.
+        unsigned char* const block = static_cast<unsigned char*>(
+            ::operator new((pooled ? size_class(bytes) : bytes) + alignment_));
+        const std::size_t offset = alignment_ -
+            reinterpret_cast<std::uintptr_t>(block) % alignment_;
+        unsigned char* const result = block + offset;
+        result[-1] = static_cast<unsigned char>(
+            pooled ? offset | pooled_flag : offset);
+        return result;
+    }
+
+    // bytes must be the size given to allocate.
+    void deallocate(void* ptr, std::size_t bytes)
+    {
+        const unsigned char* const header =
+            static_cast<const unsigned char*>(ptr);
+        if ((header[-1] & pooled_flag) != 0 && reserve(size_class(bytes)))
+        {
+            size_class_blocks& blocks = size_classes_[size_class_index(bytes)];
+            std::lock_guard<std::mutex> lock(blocks.mutex_);
+            blocks.blocks_.push_back(ptr);
+            return;
+        }
+        release(ptr);
+    }
+
+    buffer_pool_stats stats() const
+    {
+        return {hits_, misses_, retained_bytes_};
+    }
+
+    // Frees retained blocks (largest first)
+    // until at most max_retained_bytes are left.
+    void set_max_retained_bytes(std::size_t max_retained_bytes)
+    {
+        max_retained_bytes_ = max_retained_bytes;
+        std::vector<void*> released;
+        for (std::size_t i = size_class_count; i > 0 &&
+            retained_bytes_ > max_retained_bytes; --i)
+        {
+            size_class_blocks& blocks = size_classes_[i - 1];
+            std::lock_guard<std::mutex> lock(blocks.mutex_);
+            while (!blocks.blocks_.empty() &&
+                retained_bytes_ > max_retained_bytes)
+            {
+                released.push_back(blocks.blocks_.back());
+                blocks.blocks_.pop_back();
+                retained_bytes_ -= size_of_class(i - 1);
+            }
+        }
+        for (void* ptr : released)
+        {
+            release(ptr);
+        }
+    }
+
+    void clear()
+    {
+        for (std::size_t i = 0; i < size_class_count; ++i)
+        {
+            std::vector<void*> released;
+            {
+                size_class_blocks& blocks = size_classes_[i];
+                std::lock_guard<std::mutex> lock(blocks.mutex_);
+                std::swap(released, blocks.blocks_);
+            }
+            retained_bytes_ -= released.size() * size_of_class(i);
+            for (void* ptr : released)
+            {
+                release(ptr);
+            }
+        }
+    }
+
+    static std::size_t size_class(std::size_t bytes)
+    {
+        return size_of_class(size_class_index(bytes));
+    }
+
+private:
+    struct size_class_blocks
+    {
+        size_class_blocks() : mutex_(), blocks_() {}
+        std::mutex mutex_;
+        std::vector<void*> blocks_;
+    };
+
+    static const unsigned char pooled_flag = 128;
+
+    // Larger blocks are never kept.
+    static const std::size_t max_pooled_size = std::size_t(1) << 40;
+    static const std::size_t size_class_count = 1 + 4 * (40 - 6);
+
+    // 64 bytes, then four classes per power of two.
+    static std::size_t size_class_index(std::size_t bytes)
+    {
+        if (bytes <= 64)
+        {
+            return 0;
+        }
+        std::size_t power = 128;
+        std::size_t log = 7;
+        while (power < bytes)
+        {
+            power *= 2;
+            ++log;
+        }
+        const std::size_t step = power / 8;
+        return 1 + 4 * (log - 7) + (bytes + step - 1) / step - 5;
+    }
+
+    static std::size_t size_of_class(std::size_t idx)
+    {
+        if (idx == 0)
+        {
+            return 64;
+        }
+        const std::size_t power = std::size_t(128) << ((idx - 1) / 4);
+        return (5 + (idx - 1) % 4) * (power / 8);
+    }
+
+    // Counts size as retained, if this stays within the limit.
+    bool reserve(std::size_t size)
+    {
+        std::size_t retained = retained_bytes_;
+        do
+        {
+            if (retained + size > max_retained_bytes_)
+            {
+                return false;
+            }
+        } while (!retained_bytes_.compare_exchange_weak(
+            retained, retained + size));
+        return true;
+    }
+
+    static void release(void* ptr)
+    {
+        unsigned char* const result = static_cast<unsigned char*>(ptr);
+        ::operator delete(result -
+            static_cast<std::size_t>(result[-1] & (pooled_flag - 1)));
+    }
+
+    std::size_t alignment_;
+    std::atomic<std::size_t> max_retained_bytes_;
+    std::atomic<std::size_t> retained_bytes_;
+    std::atomic<std::size_t> hits_;
+    std::atomic<std::size_t> misses_;
+    std::array<size_class_blocks, size_class_count> size_classes_;
+};
+
+} // namespace internal
+
+using buffer_pool_stats = internal::buffer_pool_stats;
+
+} // namespace fdeep
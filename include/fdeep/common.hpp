@@ -28,9 +28,13 @@
 #pragma GCC diagnostic pop
 #endif
 
+#include "fdeep/buffer_pool.hpp"
+
 #include <fplus/fplus.hpp>
 
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <string>
@@ -71,9 +75,96 @@ inline void assertion(bool cond, const std::string& error)
     typedef float float_type;
 #endif
 
-typedef std::vector<float_type> float_vec;
+// Storage order of the values of a tensor3.
+// Channels-first (depth, height, width) keeps the pixels of a channel
+// together, channels-last (height, width, depth) the channels of a pixel.
+#ifdef FDEEP_CHANNELS_LAST
+    const bool channels_last_layout = true;
+#else
+    const bool channels_last_layout = false;
+#endif
+
+// Alignment of the values of all tensors in bytes,
+// enough for aligned loads and stores of AVX-512 registers.
+const std::size_t tensor_alignment = 64;
+
+// Process-wide pool the values of all tensors are allocated from.
+// Disabled until a limit is set with set_buffer_pool_limit.
+// Its blocks are kept until the end of the process,
+// since tensors may be destroyed after static objects.
+inline buffer_pool& global_buffer_pool()
+{
+    static buffer_pool* const pool = new buffer_pool(tensor_alignment, 0);
+    return *pool;
+}
+
+// Allocates memory starting at a multiple of tensor_alignment
+// from the global_buffer_pool.
+template <typename T>
+class aligned_allocator
+{
+public:
+    typedef T value_type;
+    aligned_allocator() = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U>&)
+    {
+    }
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(global_buffer_pool().allocate(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, std::size_t n)
+    {
+        global_buffer_pool().deallocate(ptr, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const aligned_allocator<T>&, const aligned_allocator<U>&)
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const aligned_allocator<T>&, const aligned_allocator<U>&)
+{
+    return false;
+}
+
+typedef std::vector<float_type, aligned_allocator<float_type>> float_vec;
 typedef fplus::shared_ref<float_vec> shared_float_vec;
 
+// Uninitialized values from the global_buffer_pool,
+// e.g. for intermediate matrices of a computation.
+// An empty buffer does not allocate anything.
+class scratch_buffer
+{
+public:
+    explicit scratch_buffer(std::size_t size) :
+        size_(size),
+        data_(size == 0 ? nullptr :
+            aligned_allocator<float_type>().allocate(size))
+    {
+    }
+    ~scratch_buffer()
+    {
+        if (data_ != nullptr)
+        {
+            aligned_allocator<float_type>().deallocate(data_, size_);
+        }
+    }
+    scratch_buffer(const scratch_buffer&) = delete;
+    scratch_buffer& operator=(const scratch_buffer&) = delete;
+    float_type* data() const
+    {
+        return data_;
+    }
+private:
+    std::size_t size_;
+    float_type* data_;
+};
+
 using RowMajorMatrixXf = Eigen::Matrix<float_type, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
 
 } } // namespace fdeep, namespace internal
@@ -9,9 +9,12 @@
 #include "fdeep/common.hpp"
 
 #include "fdeep/filter.hpp"
+#include "fdeep/thread_pool.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <utility>
 #include <vector>
 
 namespace fdeep { namespace internal
@@ -20,6 +23,7 @@ namespace fdeep { namespace internal
 struct im2col_filter_matrix
 {
     RowMajorMatrixXf mat_;
+    float_vec biases_;
     shape3 filter_shape_;
     std::size_t filter_count_;
 };
@@ -34,27 +38,61 @@ inline im2col_filter_matrix generate_im2col_filter_matrix(
     const std::size_t fz = filters.front().shape().depth_;
     const std::size_t fy = filters.front().shape().height_;
     const std::size_t fx = filters.front().shape().width_;
-    RowMajorMatrixXf b(filters.size(), fz * fy * fx + 1);
+    RowMajorMatrixXf b(filters.size(), fz * fy * fx);
+    float_vec biases;
+    biases.reserve(filters.size());
     Eigen::Index b_y = 0;
     Eigen::Index b_x = 0;
     for (std::size_t f = 0; f < filters.size(); ++f)
     {
         b_x = 0;
         const filter& filter = filters[f];
-        for (std::size_t zf = 0; zf < fz; ++zf)
+        // The weights are ordered like the values of an input patch.
+        if (channels_last_layout)
         {
             for (std::size_t yf = 0; yf < fy; ++yf)
             {
                 for (std::size_t xf = 0; xf < fx; ++xf)
                 {
-                    b(b_y, b_x++) = filter.get(zf, yf, xf);
+                    for (std::size_t zf = 0; zf < fz; ++zf)
+                    {
+                        b(b_y, b_x++) = filter.get(zf, yf, xf);
+                    }
                 }
             }
         }
-        b(b_y, b_x++) = filter.get_bias();
+        else
+        {
+            for (std::size_t zf = 0; zf < fz; ++zf)
+            {
+                for (std::size_t yf = 0; yf < fy; ++yf)
+                {
+                    for (std::size_t xf = 0; xf < fx; ++xf)
+                    {
+                        b(b_y, b_x++) = filter.get(zf, yf, xf);
+                    }
+                }
+            }
+        }
+        biases.push_back(filter.get_bias());
         ++b_y;
     }
-    return {b, filters.front().shape(), filters.size()};
+    return {b, biases, filters.front().shape(), filters.size()};
+}
+
+// Changes the filters such that the output of a convolution
+// becomes output * scale + shift (per channel).
+inline void fold_scale_shift_into_im2col_filter_matrix(
+    im2col_filter_matrix& filter_mat,
+    const float_vec& scale, const float_vec& shift)
+{
+    assertion(scale.size() == filter_mat.filter_count_ &&
+        shift.size() == filter_mat.filter_count_, "invalid scale or shift");
+    for (std::size_t f = 0; f < filter_mat.filter_count_; ++f)
+    {
+        filter_mat.mat_.row(static_cast<Eigen::Index>(f)) *= scale[f];
+        filter_mat.biases_[f] = filter_mat.biases_[f] * scale[f] + shift[f];
+    }
 }
 
 inline im2col_filter_matrix generate_im2col_single_filter_matrix(
@@ -63,76 +101,464 @@ inline im2col_filter_matrix generate_im2col_single_filter_matrix(
     return generate_im2col_filter_matrix(filter_vec(1, filter));
 }
 
+// Reads count values of depth slice z along row in_y of the input,
+// starting at column first_x in steps of x_step.
+// Positions outside of the input (padding) are read as 0.
+inline void gather_input_row(const tensor3_view& in, std::size_t z,
+    int in_y, int first_x, std::size_t x_step, std::size_t count,
+    float_type* dest)
+{
+    const int height = static_cast<int>(in.shape().height_);
+    const int width = static_cast<int>(in.shape().width_);
+    if (in_y < 0 || in_y >= height)
+    {
+        std::fill_n(dest, count, static_cast<float_type>(0));
+        return;
+    }
+    const float_type* const row = in.data() + z * in.z_stride() +
+        static_cast<std::size_t>(in_y) * in.y_stride();
+    int in_x = first_x;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        dest[i] = in_x < 0 || in_x >= width ? static_cast<float_type>(0) :
+            row[static_cast<std::size_t>(in_x) * in.x_stride()];
+        in_x += static_cast<int>(x_step);
+    }
+}
+
+// Number of output values a convolution computes in one go,
+// before finishing them while they are still in cache.
+const std::size_t conv_output_block_size = 32768;
+
+// A convolution writes its outputs into the given destinations if any,
+// e.g. into the output of a following concatenation,
+// and returns no tensors then. Otherwise new tensors are allocated.
+inline std::vector<shared_float_vec> allocate_conv_outputs(
+    std::size_t count, std::size_t volume,
+    const std::vector<float_type*>& destinations)
+{
+    if (!destinations.empty())
+    {
+        assertion(destinations.size() == count, "invalid destination count");
+        return {};
+    }
+    const trace_span span("allocate", "convolution");
+    return fplus::generate<std::vector<shared_float_vec>>([&]()
+    {
+        return fplus::make_shared_ref<float_vec>(volume);
+    }, count);
+}
+
+inline std::vector<float_type*> conv_output_pointers(
+    std::vector<shared_float_vec>& res_vecs,
+    const std::vector<float_type*>& destinations)
+{
+    if (!destinations.empty())
+    {
+        return destinations;
+    }
+    std::vector<float_type*> result;
+    result.reserve(res_vecs.size());
+    for (auto& res_vec : res_vecs)
+    {
+        result.push_back(res_vec->data());
+    }
+    return result;
+}
+
 // GEMM convolution, faster but uses more RAM
 // https://stackoverflow.com/questions/16798888/2-d-convolution-as-a-matrix-matrix-multiplication
 // https://github.com/tensorflow/tensorflow/blob/a0d784bdd31b27e013a7eac58a86ba62e86db299/tensorflow/core/kernels/conv_ops_using_gemm.cc
 // http://www.youtube.com/watch?v=pA4BsUK3oP4&t=36m22s
-inline tensor3 convolve_im2col(
+// All entries of a batch are convolved together:
+// Their output pixels form the columns of one GEMM.
+// 1x1 convolutions without strides and padding multiply
+// the input values directly, without an im2col copy.
+inline tensor3s convolve_im2col(
     std::size_t out_height,
     std::size_t out_width,
     std::size_t strides_y,
     std::size_t strides_x,
     std::size_t offset_y,
     std::size_t offset_x,
+    std::size_t pad_top,
+    std::size_t pad_left,
     const im2col_filter_matrix& filter_mat,
-    const tensor3& in_padded)
+    const tensor3_views& inputs,
+    const pixel_block_transform& epilogue,
+    const std::vector<float_type*>& destinations)
 {
     const auto fz = filter_mat.filter_shape_.depth_;
     const auto fy = filter_mat.filter_shape_.height_;
     const auto fx = filter_mat.filter_shape_.width_;
-    RowMajorMatrixXf a(fz * fy * fx + 1, out_height * out_width);
-    Eigen::Index a_y = 0;
-    for (std::size_t zf = 0; zf < fz; ++zf)
+    const std::size_t out_depth = filter_mat.filter_count_;
+    const std::size_t out_area = out_height * out_width;
+    const std::size_t col_count = inputs.size() * out_area;
+    assertion(static_cast<std::size_t>(filter_mat.mat_.rows()) == out_depth,
+        "Invalid target size");
+    const int pad_top_int = static_cast<int>(pad_top);
+    const int pad_left_int = static_cast<int>(pad_left);
+    const auto& in_shape = inputs.front().shape();
+    const bool direct = fy == 1 && fx == 1 &&
+        strides_y == 1 && strides_x == 1 &&
+        in_shape.height_ == out_height && in_shape.width_ == out_width &&
+        fplus::all_by(
+            fplus_c_mem_fn_t(tensor3_view, has_dense_strides, bool), inputs);
+
+    auto res_vecs = allocate_conv_outputs(
+        inputs.size(), out_depth * out_area, destinations);
+    const auto out_ptrs = conv_output_pointers(res_vecs, destinations);
+
+    // The outputs may be given by the caller, e.g. at an offset in the
+    // buffer of a concatenation, so they are not necessarily aligned.
+    const auto out_mat_map = [&](std::size_t sample)
     {
-        for (std::size_t yf = 0; yf < fy; ++yf)
+        return Eigen::Map<RowMajorMatrixXf, Eigen::Unaligned>(
+            out_ptrs[sample],
+            static_cast<Eigen::Index>(out_depth),
+            static_cast<Eigen::Index>(out_area));
+    };
+
+    // The output is calculated in blocks of pixels, each one with its own
+    // part of the im2col matrix, so they are still in cache when
+    // bias and activation are applied. Blocks can be done in parallel.
+    const std::size_t thread_count = parallel_op_thread_count();
+    std::size_t block_pixels = std::max<std::size_t>(256,
+        conv_output_block_size / out_depth);
+    if (thread_count > 1)
+    {
+        block_pixels = std::min(block_pixels, std::max<std::size_t>(32,
+            (col_count + thread_count - 1) / thread_count));
+    }
+    const std::size_t block_count =
+        (col_count + block_pixels - 1) / block_pixels;
+
+    parallel_for(block_count, [&](std::size_t block_idx)
+    {
+        const std::size_t first = block_idx * block_pixels;
+        const std::size_t count = std::min(block_pixels, col_count - first);
+        const std::size_t first_sample = first / out_area;
+        const std::size_t first_pixel = first % out_area;
+        const bool single_sample = first_pixel + count <= out_area;
+
+        if (direct)
         {
-            for (std::size_t xf = 0; xf < fx; ++xf)
+            // A block spanning multiple entries of the batch
+            // is multiplied in one part per entry.
+            for (std::size_t col = 0; col < count;)
             {
-                Eigen::Index a_x = 0;
-                for (std::size_t y = 0; y < out_height; ++y)
+                const std::size_t sample = (first + col) / out_area;
+                const std::size_t pixel = (first + col) % out_area;
+                const std::size_t pixels =
+                    std::min(out_area - pixel, count - col);
+                // The channels of the input are the rows of the matrix,
+                // starting at the (unaligned) first pixel of the part.
+                const Eigen::Map<const RowMajorMatrixXf, Eigen::Unaligned,
+                    Eigen::OuterStride<>> a(
+                        inputs[sample].data() + pixel,
+                        static_cast<Eigen::Index>(fz),
+                        static_cast<Eigen::Index>(pixels),
+                        Eigen::OuterStride<>(
+                            static_cast<Eigen::Index>(out_area)));
                 {
-                    for (std::size_t x = 0; x < out_width; ++x)
+                    const trace_span span("GEMM", "convolution");
+                    out_mat_map(sample).middleCols(
+                        static_cast<Eigen::Index>(pixel),
+                        static_cast<Eigen::Index>(pixels)).noalias() =
+                            filter_mat.mat_ * a;
+                }
+                finish_pixel_block(filter_mat.biases_, epilogue,
+                    {out_ptrs[sample], out_depth, out_area,
+                    pixel, pixels});
+                col += pixels;
+            }
+            return;
+        }
+
+        const scratch_buffer a_values(fz * fy * fx * count);
+        Eigen::Map<RowMajorMatrixXf, Eigen::Aligned64> a(a_values.data(),
+            static_cast<Eigen::Index>(fz * fy * fx),
+            static_cast<Eigen::Index>(count));
+        {
+            const trace_span span("im2col", "convolution");
+            std::size_t a_y = 0;
+            for (std::size_t zf = 0; zf < fz; ++zf)
+            {
+                for (std::size_t yf = 0; yf < fy; ++yf)
+                {
+                    for (std::size_t xf = 0; xf < fx; ++xf)
                     {
-                        a(a_y, a_x++) = in_padded.get(zf,
-                                offset_y + strides_y * y + yf,
-                                offset_x + strides_x * x + xf);
+                        std::size_t sample = first / out_area;
+                        std::size_t y = (first % out_area) / out_width;
+                        std::size_t x = (first % out_area) % out_width;
+                        float_type* a_row = a.data() + a_y * count;
+                        // Output pixels are gathered row by row.
+                        for (std::size_t a_x = 0; a_x < count;)
+                        {
+                            const std::size_t run =
+                                std::min(out_width - x, count - a_x);
+                            gather_input_row(inputs[sample], zf,
+                                static_cast<int>(offset_y + strides_y * y +
+                                    yf) - pad_top_int,
+                                static_cast<int>(offset_x + strides_x * x +
+                                    xf) - pad_left_int,
+                                strides_x, run, a_row + a_x);
+                            a_x += run;
+                            x = 0;
+                            if (++y == out_height)
+                            {
+                                y = 0;
+                                ++sample;
+                            }
+                        }
+                        ++a_y;
                     }
                 }
-                ++a_y;
             }
         }
-    }
 
-    Eigen::Index a_x = 0;
-    for (std::size_t y = 0; y < out_height; ++y)
-    {
-        for (std::size_t x = 0; x < out_width; ++x)
+        if (single_sample)
+        {
+            {
+                const trace_span span("GEMM", "convolution");
+                // https://stackoverflow.com/questions/48644724/multiply-two-eigen-matrices-directly-into-memory-of-target-matrix
+                out_mat_map(first_sample).middleCols(
+                    static_cast<Eigen::Index>(first_pixel),
+                    static_cast<Eigen::Index>(count)).noalias() =
+                        filter_mat.mat_ * a;
+            }
+            finish_pixel_block(filter_mat.biases_, epilogue,
+                {out_ptrs[first_sample], out_depth, out_area,
+                first_pixel, count});
+            return;
+        }
+
+        // The block spans multiple entries of the batch.
+        const RowMajorMatrixXf out_block = [&]()
+        {
+            const trace_span span("GEMM", "convolution");
+            return RowMajorMatrixXf(filter_mat.mat_ * a);
+        }();
+        for (std::size_t col = 0; col < count;)
         {
-            a(a_y, a_x++) = static_cast<float_type>(1);
+            const std::size_t sample = (first + col) / out_area;
+            const std::size_t pixel = (first + col) % out_area;
+            const std::size_t pixels = std::min(out_area - pixel, count - col);
+            out_mat_map(sample).middleCols(
+                static_cast<Eigen::Index>(pixel),
+                static_cast<Eigen::Index>(pixels)) = out_block.middleCols(
+                    static_cast<Eigen::Index>(col),
+                    static_cast<Eigen::Index>(pixels));
+            finish_pixel_block(filter_mat.biases_, epilogue,
+                {out_ptrs[sample], out_depth, out_area,
+                pixel, pixels});
+            col += pixels;
         }
-    }
+    });
 
-    const std::size_t val_cnt =
-        static_cast<std::size_t>(filter_mat.mat_.rows() * a.cols());
-    assertion(val_cnt % (out_height * out_width) == 0,
-        "Can not calculate out_depth");
+    return fplus::transform([&](const shared_float_vec& res_vec) -> tensor3
+    {
+        return tensor3(storage_order_tag(),
+            shape3(out_depth, out_height, out_width), res_vec);
+    }, res_vecs);
+}
 
-    const std::size_t out_depth = val_cnt / (out_height * out_width);
-    assertion(val_cnt == out_depth * out_height * out_width,
+// Channels-last variant of convolve_im2col.
+// The im2col matrix holds one row per output pixel, made of contiguous
+// runs of input values, and the GEMM writes all channels of each output
+// pixel in place. 1x1 convolutions without strides and padding
+// multiply the input values directly, without an im2col copy.
+inline tensor3s convolve_im2col_channels_last(
+    std::size_t out_height,
+    std::size_t out_width,
+    std::size_t strides_y,
+    std::size_t strides_x,
+    std::size_t offset_y,
+    std::size_t offset_x,
+    std::size_t pad_top,
+    std::size_t pad_left,
+    const im2col_filter_matrix& filter_mat,
+    const tensor3_views& inputs,
+    const pixel_block_transform& epilogue,
+    const std::vector<float_type*>& destinations)
+{
+    const auto fz = filter_mat.filter_shape_.depth_;
+    const auto fy = filter_mat.filter_shape_.height_;
+    const auto fx = filter_mat.filter_shape_.width_;
+    const std::size_t patch_size = fz * fy * fx;
+    const std::size_t out_depth = filter_mat.filter_count_;
+    const std::size_t out_area = out_height * out_width;
+    const std::size_t col_count = inputs.size() * out_area;
+    assertion(static_cast<std::size_t>(filter_mat.mat_.rows()) == out_depth,
         "Invalid target size");
+    const int pad_top_int = static_cast<int>(pad_top);
+    const int pad_left_int = static_cast<int>(pad_left);
+    const auto& in_shape = inputs.front().shape();
+    const int in_height = static_cast<int>(in_shape.height_);
+    const int in_width = static_cast<int>(in_shape.width_);
+    const bool direct = fy == 1 && fx == 1 &&
+        strides_y == 1 && strides_x == 1 &&
+        in_shape.height_ == out_height && in_shape.width_ == out_width &&
+        fplus::all_by(
+            fplus_c_mem_fn_t(tensor3_view, has_dense_strides, bool), inputs);
+
+    auto res_vecs = allocate_conv_outputs(
+        inputs.size(), out_area * out_depth, destinations);
+    const auto out_ptrs = conv_output_pointers(res_vecs, destinations);
+
+    // Blocks start at arbitrary pixels of outputs possibly given
+    // by the caller, so they are not necessarily aligned.
+    const auto out_mat_rows = [&](std::size_t sample,
+        std::size_t first_pixel, std::size_t pixels)
+    {
+        return Eigen::Map<RowMajorMatrixXf, Eigen::Unaligned>(
+            out_ptrs[sample] + first_pixel * out_depth,
+            static_cast<Eigen::Index>(pixels),
+            static_cast<Eigen::Index>(out_depth));
+    };
+
+    const std::size_t thread_count = parallel_op_thread_count();
+    std::size_t block_pixels = std::max<std::size_t>(256,
+        conv_output_block_size / out_depth);
+    if (thread_count > 1)
+    {
+        block_pixels = std::min(block_pixels, std::max<std::size_t>(32,
+            (col_count + thread_count - 1) / thread_count));
+    }
+    const std::size_t block_count =
+        (col_count + block_pixels - 1) / block_pixels;
+
+    parallel_for(block_count, [&](std::size_t block_idx)
+    {
+        const std::size_t first = block_idx * block_pixels;
+        const std::size_t count = std::min(block_pixels, col_count - first);
+        const std::size_t first_sample = first / out_area;
+        const std::size_t first_pixel = first % out_area;
+        const bool single_sample = first_pixel + count <= out_area;
+
+        if (direct)
+        {
+            // A block spanning multiple entries of the batch
+            // is multiplied in one part per entry.
+            for (std::size_t row_idx = 0; row_idx < count;)
+            {
+                const std::size_t sample = (first + row_idx) / out_area;
+                const std::size_t pixel = (first + row_idx) % out_area;
+                const std::size_t pixels =
+                    std::min(out_area - pixel, count - row_idx);
+                const Eigen::Map<const RowMajorMatrixXf, Eigen::Unaligned> a(
+                    inputs[sample].data() + pixel * fz,
+                    static_cast<Eigen::Index>(pixels),
+                    static_cast<Eigen::Index>(fz));
+                {
+                    const trace_span span("GEMM", "convolution");
+                    out_mat_rows(sample, pixel, pixels).noalias() =
+                        a * filter_mat.mat_.transpose();
+                }
+                finish_pixel_block(filter_mat.biases_, epilogue,
+                    {out_ptrs[sample], out_depth, out_area,
+                    pixel, pixels});
+                row_idx += pixels;
+            }
+            return;
+        }
 
-    shared_float_vec res_vec = fplus::make_shared_ref<float_vec>();
-    res_vec->resize(static_cast<std::size_t>(out_depth * out_height * out_width));
+        const scratch_buffer a_values(count * patch_size);
+        Eigen::Map<RowMajorMatrixXf, Eigen::Aligned64> a(a_values.data(),
+            static_cast<Eigen::Index>(count),
+            static_cast<Eigen::Index>(patch_size));
+        {
+            const trace_span span("im2col", "convolution");
+            std::size_t sample = first_sample;
+            std::size_t y = first_pixel / out_width;
+            std::size_t x = first_pixel % out_width;
+            float_type* row = a.data();
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const auto& in = inputs[sample];
+                for (std::size_t yf = 0; yf < fy; ++yf)
+                {
+                    const int in_y = static_cast<int>(
+                        offset_y + strides_y * y + yf) - pad_top_int;
+                    for (std::size_t xf = 0; xf < fx; ++xf)
+                    {
+                        const int in_x = static_cast<int>(
+                            offset_x + strides_x * x + xf) - pad_left_int;
+                        if (in_y < 0 || in_y >= in_height ||
+                            in_x < 0 || in_x >= in_width)
+                        {
+                            row = std::fill_n(row, fz, static_cast<float_type>(0));
+                            continue;
+                        }
+                        // All channels of one input pixel.
+                        const float_type* const src = in.data() +
+                            static_cast<std::size_t>(in_y) * in.y_stride() +
+                            static_cast<std::size_t>(in_x) * in.x_stride();
+                        if (in.z_stride() == 1)
+                        {
+                            row = std::copy(src, src + fz, row);
+                        }
+                        else
+                        {
+                            for (std::size_t z = 0; z < fz; ++z)
+                            {
+                                *(row++) = src[z * in.z_stride()];
+                            }
+                        }
+                    }
+                }
+                if (++x == out_width)
+                {
+                    x = 0;
+                    if (++y == out_height)
+                    {
+                        y = 0;
+                        ++sample;
+                    }
+                }
+            }
+        }
 
-    Eigen::Map<RowMajorMatrixXf, Eigen::Unaligned> out_mat_map(
-        res_vec->data(),
-        static_cast<Eigen::Index>(filter_mat.mat_.rows()),
-        static_cast<Eigen::Index>(a.cols()));
+        if (single_sample)
+        {
+            {
+                const trace_span span("GEMM", "convolution");
+                out_mat_rows(first_sample, first_pixel, count).noalias() =
+                    a * filter_mat.mat_.transpose();
+            }
+            finish_pixel_block(filter_mat.biases_, epilogue,
+                {out_ptrs[first_sample], out_depth, out_area,
+                first_pixel, count});
+            return;
+        }
 
-    // https://stackoverflow.com/questions/48644724/multiply-two-eigen-matrices-directly-into-memory-of-target-matrix
-    out_mat_map.noalias() = filter_mat.mat_ * a;
+        // The block spans multiple entries of the batch.
+        const RowMajorMatrixXf out_block = [&]()
+        {
+            const trace_span span("GEMM", "convolution");
+            return RowMajorMatrixXf(a * filter_mat.mat_.transpose());
+        }();
+        for (std::size_t row_idx = 0; row_idx < count;)
+        {
+            const std::size_t sample = (first + row_idx) / out_area;
+            const std::size_t pixel = (first + row_idx) % out_area;
+            const std::size_t pixels =
+                std::min(out_area - pixel, count - row_idx);
+            out_mat_rows(sample, pixel, pixels) = out_block.middleRows(
+                static_cast<Eigen::Index>(row_idx),
+                static_cast<Eigen::Index>(pixels));
+            finish_pixel_block(filter_mat.biases_, epilogue,
+                {out_ptrs[sample], out_depth, out_area,
+                pixel, pixels});
+            row_idx += pixels;
+        }
+    });
 
-    return tensor3(shape3(out_depth, out_height, out_width), res_vec);
+    return fplus::transform([&](const shared_float_vec& res_vec) -> tensor3
+    {
+        return tensor3(storage_order_tag(),
+            shape3(out_depth, out_height, out_width), res_vec);
+    }, res_vecs);
 }
 
 enum class padding { valid, same };
@@ -215,34 +641,297 @@ inline convolution_config preprocess_convolution(
         out_height_size_t, out_width_size_t};
 }
 
-inline tensor3 convolve(
+// The padding is applied implicitly while reading the input.
+inline tensor3s convolve(
     const shape2& strides,
     const padding& pad_type,
     bool use_offset,
     const im2col_filter_matrix& filter_mat,
-    const tensor3& input)
+    const tensor3_views& inputs,
+    const pixel_block_transform& epilogue = nullptr,
+    const std::vector<float_type*>& destinations = {})
 {
-    assertion(filter_mat.filter_shape_.depth_ == input.shape().depth_,
+    assertion(!inputs.empty(), "no input tensors");
+    const auto& input_shape = inputs.front().shape();
+    assertion(filter_mat.filter_shape_.depth_ == input_shape.depth_,
         "invalid filter depth");
+    assertion(fplus::all_the_same_on(
+        fplus_c_mem_fn_t(tensor3_view, shape, shape3), inputs),
+        "all tensors of a batch must have the same shape");
 
     const auto conv_cfg = preprocess_convolution(
         filter_mat.filter_shape_.without_depth(),
-        strides, pad_type, use_offset, input.shape());
+        strides, pad_type, use_offset, input_shape);
 
     const std::size_t offset_y = conv_cfg.offset_y_;
     const std::size_t offset_x = conv_cfg.offset_x_;
     const std::size_t out_height = conv_cfg.out_height_;
     const std::size_t out_width = conv_cfg.out_width_;
 
-    const auto in_padded = pad_tensor3(0,
-        conv_cfg.pad_top_, conv_cfg.pad_bottom_, conv_cfg.pad_left_, conv_cfg.pad_right_,
-        input);
-
+    if (channels_last_layout)
+    {
+        return convolve_im2col_channels_last(
+            out_height, out_width,
+            strides.height_, strides.width_,
+            offset_y, offset_x,
+            conv_cfg.pad_top_, conv_cfg.pad_left_,
+            filter_mat, inputs, epilogue, destinations);
+    }
     return convolve_im2col(
         out_height, out_width,
         strides.height_, strides.width_,
         offset_y, offset_x,
-        filter_mat, in_padded);
+        conv_cfg.pad_top_, conv_cfg.pad_left_,
+        filter_mat, inputs, epilogue, destinations);
+}
+
+inline tensor3s convolve(
+    const shape2& strides,
+    const padding& pad_type,
+    bool use_offset,
+    const im2col_filter_matrix& filter_mat,
+    const tensor3s& inputs,
+    const pixel_block_transform& epilogue = nullptr,
+    const std::vector<float_type*>& destinations = {})
+{
+    return convolve(strides, pad_type, use_offset, filter_mat,
+        tensor3_views_of(inputs), epilogue, destinations);
+}
+
+inline tensor3 convolve(
+    const shape2& strides,
+    const padding& pad_type,
+    bool use_offset,
+    const im2col_filter_matrix& filter_mat,
+    const tensor3& input,
+    const pixel_block_transform& epilogue = nullptr)
+{
+    return convolve(strides, pad_type, use_offset, filter_mat,
+        tensor3s(1, input), epilogue).front();
+}
+
+// Filters of a depthwise convolution, one of depth 1 per input channel,
+// each producing the output channel of the same index.
+// The weights are ordered like the values of the input, i.e. with
+// channels-last layout the weights of all channels at one filter position
+// are contiguous.
+struct depthwise_filter_matrix
+{
+    float_vec weights_;
+    float_vec biases_;
+    shape2 filter_size_;
+    std::size_t depth_;
+};
+
+inline depthwise_filter_matrix generate_depthwise_filter_matrix(
+    const filter_vec& filters)
+{
+    assertion(!filters.empty(), "no filters");
+    assertion(fplus::all_the_same_on(
+        fplus_c_mem_fn_t(filter, shape, shape3), filters),
+        "all filters must have the same shape");
+    assertion(filters.front().shape().depth_ == 1, "invalid filter depth");
+    const std::size_t depth = filters.size();
+    const std::size_t fy = filters.front().shape().height_;
+    const std::size_t fx = filters.front().shape().width_;
+    float_vec weights(depth * fy * fx);
+    for (std::size_t z = 0; z < depth; ++z)
+    {
+        for (std::size_t yf = 0; yf < fy; ++yf)
+        {
+            for (std::size_t xf = 0; xf < fx; ++xf)
+            {
+                const std::size_t idx = channels_last_layout ?
+                    (yf * fx + xf) * depth + z :
+                    (z * fy + yf) * fx + xf;
+                weights[idx] = filters[z].get(0, yf, xf);
+            }
+        }
+    }
+    float_vec biases;
+    biases.reserve(depth);
+    for (const auto& filt : filters)
+    {
+        biases.push_back(filt.get_bias());
+    }
+    return {weights, biases, shape2(fy, fx), depth};
+}
+
+// The output positions [first, second) reading inside the input
+// (of the given size) at filter offset f, if output position o reads
+// input position start + stride * o + f.
+inline std::pair<std::size_t, std::size_t> depthwise_valid_range(
+    int start, std::size_t stride, std::size_t f,
+    std::size_t in_size, std::size_t out_size)
+{
+    const int first_in = start + static_cast<int>(f);
+    const int stride_int = static_cast<int>(stride);
+    const int size_int = static_cast<int>(in_size);
+    const int first = first_in >= 0 ? 0 :
+        (stride_int - 1 - first_in) / stride_int;
+    const int last = first_in >= size_int ? 0 :
+        (size_int - 1 - first_in) / stride_int + 1;
+    const std::size_t end = std::min(out_size, static_cast<std::size_t>(last));
+    return std::make_pair(
+        std::min(end, static_cast<std::size_t>(first)), end);
+}
+
+// Convolves every channel of the inputs with its own filter,
+// all channels in one pass over the input.
+// The padding is applied implicitly while reading the input.
+inline tensor3s depthwise_convolve(
+    const shape2& strides,
+    const padding& pad_type,
+    bool use_offset,
+    const depthwise_filter_matrix& filter_mat,
+    const tensor3_views& inputs)
+{
+    assertion(!inputs.empty(), "no input tensors");
+    const auto& input_shape = inputs.front().shape();
+    assertion(filter_mat.depth_ == input_shape.depth_, "invalid input depth");
+    assertion(fplus::all_the_same_on(
+        fplus_c_mem_fn_t(tensor3_view, shape, shape3), inputs),
+        "all tensors of a batch must have the same shape");
+
+    const auto conv_cfg = preprocess_convolution(filter_mat.filter_size_,
+        strides, pad_type, use_offset, input_shape);
+    const std::size_t depth = filter_mat.depth_;
+    const std::size_t fy = filter_mat.filter_size_.height_;
+    const std::size_t fx = filter_mat.filter_size_.width_;
+    const std::size_t out_height = conv_cfg.out_height_;
+    const std::size_t out_width = conv_cfg.out_width_;
+    const int start_y = static_cast<int>(conv_cfg.offset_y_) -
+        static_cast<int>(conv_cfg.pad_top_);
+    const int start_x = static_cast<int>(conv_cfg.offset_x_) -
+        static_cast<int>(conv_cfg.pad_left_);
+
+    // Output rows and columns reading inside the input per filter offset.
+    std::vector<std::pair<std::size_t, std::size_t>> y_ranges;
+    for (std::size_t yf = 0; yf < fy; ++yf)
+    {
+        y_ranges.push_back(depthwise_valid_range(start_y, strides.height_,
+            yf, input_shape.height_, out_height));
+    }
+    std::vector<std::pair<std::size_t, std::size_t>> x_ranges;
+    for (std::size_t xf = 0; xf < fx; ++xf)
+    {
+        x_ranges.push_back(depthwise_valid_range(start_x, strides.width_,
+            xf, input_shape.width_, out_width));
+    }
+    // Input position read by output position o at filter offset f.
+    const auto in_pos = [](int start, std::size_t stride, std::size_t f,
+        std::size_t o) -> std::size_t
+    {
+        return static_cast<std::size_t>(
+            start + static_cast<int>(stride * o + f));
+    };
+
+    auto res_vecs = allocate_conv_outputs(inputs.size(),
+        depth * out_height * out_width, {});
+    const auto out_ptrs = conv_output_pointers(res_vecs, {});
+    const trace_span span("depthwise", "convolution");
+
+    if (channels_last_layout)
+    {
+        // One output row of one entry of the batch at a time.
+        parallel_for(inputs.size() * out_height, [&](std::size_t i)
+        {
+            const std::size_t sample = i / out_height;
+            const std::size_t y = i % out_height;
+            const auto& in = inputs[sample];
+            const std::size_t z_stride = in.z_stride();
+            float_type* const out_row =
+                out_ptrs[sample] + y * out_width * depth;
+            for (std::size_t x = 0; x < out_width; ++x)
+            {
+                std::copy(std::begin(filter_mat.biases_),
+                    std::end(filter_mat.biases_), out_row + x * depth);
+            }
+            for (std::size_t yf = 0; yf < fy; ++yf)
+            {
+                if (y < y_ranges[yf].first || y >= y_ranges[yf].second)
+                {
+                    continue;
+                }
+                const float_type* const in_row = in.data() +
+                    in_pos(start_y, strides.height_, yf, y) * in.y_stride();
+                for (std::size_t xf = 0; xf < fx; ++xf)
+                {
+                    const float_type* const weights =
+                        filter_mat.weights_.data() + (yf * fx + xf) * depth;
+                    for (std::size_t x = x_ranges[xf].first;
+                        x < x_ranges[xf].second; ++x)
+                    {
+                        const float_type* const in_pixel = in_row +
+                            in_pos(start_x, strides.width_, xf, x) *
+                            in.x_stride();
+                        float_type* const out_pixel = out_row + x * depth;
+                        for (std::size_t z = 0; z < depth; ++z)
+                        {
+                            out_pixel[z] += weights[z] * in_pixel[z * z_stride];
+                        }
+                    }
+                }
+            }
+        });
+    }
+    else
+    {
+        // One channel of one entry of the batch at a time.
+        parallel_for(inputs.size() * depth, [&](std::size_t i)
+        {
+            const std::size_t sample = i / depth;
+            const std::size_t z = i % depth;
+            const auto& in = inputs[sample];
+            const std::size_t x_step = strides.width_ * in.x_stride();
+            const float_type* const in_channel =
+                in.data() + z * in.z_stride();
+            const float_type* const weights =
+                filter_mat.weights_.data() + z * fy * fx;
+            float_type* const out_channel =
+                out_ptrs[sample] + z * out_height * out_width;
+            for (std::size_t y = 0; y < out_height; ++y)
+            {
+                float_type* const out_row = out_channel + y * out_width;
+                std::fill(out_row, out_row + out_width,
+                    filter_mat.biases_[z]);
+                for (std::size_t yf = 0; yf < fy; ++yf)
+                {
+                    if (y < y_ranges[yf].first || y >= y_ranges[yf].second)
+                    {
+                        continue;
+                    }
+                    const float_type* const in_row = in_channel +
+                        in_pos(start_y, strides.height_, yf, y) *
+                        in.y_stride();
+                    for (std::size_t xf = 0; xf < fx; ++xf)
+                    {
+                        const std::size_t first = x_ranges[xf].first;
+                        const std::size_t last = x_ranges[xf].second;
+                        if (first >= last)
+                        {
+                            continue;
+                        }
+                        const float_type weight = weights[yf * fx + xf];
+                        const float_type* const in_first = in_row +
+                            in_pos(start_x, strides.width_, xf, first) *
+                            in.x_stride();
+                        for (std::size_t x = first; x < last; ++x)
+                        {
+                            out_row[x] +=
+                                weight * in_first[(x - first) * x_step];
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    return fplus::transform([&](const shared_float_vec& res_vec) -> tensor3
+    {
+        return tensor3(storage_order_tag(),
+            shape3(depth, out_height, out_width), res_vec);
+    }, res_vecs);
 }
 
 inline tensor3 convolve_transpose(
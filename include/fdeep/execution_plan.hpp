@@ -0,0 +1,865 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include "fdeep/common.hpp"
+
+#include "fdeep/node.hpp"
+#include "fdeep/profiling.hpp"
+#include "fdeep/tensor3.hpp"
+#include "fdeep/thread_pool.hpp"
+#include "fdeep/layers/layer.hpp"
+
+#include <fplus/fplus.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace fdeep { namespace internal
+{
+
+// Position of a tensor in the output slots of an execution plan.
+struct tensor_ref
+{
+    std::size_t slot_idx_;
+    std::size_t tensor_idx_;
+};
+using tensor_refs = std::vector<tensor_ref>;
+
+// Position of an input of a concatenation step.
+struct concat_destination
+{
+    std::size_t step_idx_;
+    std::size_t input_idx_;
+};
+
+// One layer application (a node of the computational graph).
+// released_slots_ holds the slots, that are not needed anymore
+// once this step is done.
+// Steps with a concat_destination_ write their output directly into
+// the output of that concatenation (the only reader of it) instead of
+// their output slot. in_place_inputs_ marks the inputs of
+// a concatenation step written this way.
+// Steps with an input_view_idx_ read that model input as a view.
+// Steps with an output_idx_ produce only that model output, and write it
+// directly into memory of the caller if given (see run_execution_plan).
+// In-place steps overwrite their input tensor, which nothing else uses,
+// with their output.
+struct plan_step
+{
+    layer_ptr layer_;
+    tensor_refs inputs_;
+    std::size_t output_slot_;
+    std::vector<std::size_t> released_slots_;
+    fplus::maybe<concat_destination> concat_destination_;
+    std::vector<bool> in_place_inputs_;
+    fplus::maybe<std::size_t> input_view_idx_;
+    fplus::maybe<std::size_t> output_idx_;
+    bool in_place_;
+};
+using plan_steps = std::vector<plan_step>;
+
+// The computational graph of a model flattened (topologically sorted)
+// at load time, so a forward pass does not need any name lookups.
+// view_inputs_ marks the model inputs never copied into a tensor3.
+struct execution_plan
+{
+    std::size_t slot_count_;
+    std::vector<std::size_t> input_slots_;
+    tensor_refs outputs_;
+    plan_steps steps_;
+    std::vector<bool> view_inputs_;
+};
+
+// Index of the step producing a slot and of the last step reading it.
+// Model inputs are produced before the first step (first_ == 0),
+// model outputs are read after the last one (last_ == steps_.size()).
+// The output of a concatenation exists from the first step
+// writing into it in place. The input of an in-place step exists
+// as long as the output of the step, since they share their memory.
+struct slot_lifetime
+{
+    std::size_t first_;
+    std::size_t last_;
+};
+
+inline std::vector<slot_lifetime> get_slot_lifetimes(const execution_plan& plan)
+{
+    std::vector<slot_lifetime> lifetimes(plan.slot_count_, {0, 0});
+    for (std::size_t i = 0; i < plan.steps_.size(); ++i)
+    {
+        const auto& step = plan.steps_[i];
+        lifetimes[step.output_slot_] = {i, i};
+        for (const auto& ref : step.inputs_)
+        {
+            lifetimes[ref.slot_idx_].last_ = i;
+        }
+    }
+    for (const auto& ref : plan.outputs_)
+    {
+        lifetimes[ref.slot_idx_].last_ = plan.steps_.size();
+    }
+    for (std::size_t i = 0; i < plan.steps_.size(); ++i)
+    {
+        const auto& dest = plan.steps_[i].concat_destination_;
+        if (fplus::is_just(dest))
+        {
+            auto& lifetime = lifetimes[
+                plan.steps_[dest.unsafe_get_just().step_idx_].output_slot_];
+            lifetime.first_ = std::min(lifetime.first_, i);
+        }
+    }
+    for (std::size_t i = plan.steps_.size(); i > 0; --i)
+    {
+        const auto& step = plan.steps_[i - 1];
+        if (step.in_place_)
+        {
+            lifetimes[step.inputs_.front().slot_idx_].last_ =
+                lifetimes[step.output_slot_].last_;
+        }
+    }
+    return lifetimes;
+}
+
+// Index of the step producing each slot, steps_.size() for model inputs.
+inline std::vector<std::size_t> get_slot_producers(const execution_plan& plan)
+{
+    std::vector<std::size_t> producers(plan.slot_count_, plan.steps_.size());
+    for (std::size_t i = 0; i < plan.steps_.size(); ++i)
+    {
+        producers[plan.steps_[i].output_slot_] = i;
+    }
+    return producers;
+}
+
+// Number of references to each slot by step inputs and model outputs.
+inline std::vector<std::size_t> get_slot_read_counts(
+    const execution_plan& plan)
+{
+    std::vector<std::size_t> reads(plan.slot_count_, 0);
+    for (const auto& step : plan.steps_)
+    {
+        for (const auto& ref : step.inputs_)
+        {
+            ++reads[ref.slot_idx_];
+        }
+    }
+    for (const auto& ref : plan.outputs_)
+    {
+        ++reads[ref.slot_idx_];
+    }
+    return reads;
+}
+
+// Layers whose output is only read by a concatenation write it directly
+// into the output of the concatenation, which saves copying it.
+// Only with channels-first layout the inputs of a concatenation
+// are contiguous ranges of its output.
+inline void mark_in_place_concatenations(execution_plan& plan)
+{
+    if (channels_last_layout)
+    {
+        return;
+    }
+    const std::size_t step_count = plan.steps_.size();
+    const auto producers = get_slot_producers(plan);
+    const auto reads = get_slot_read_counts(plan);
+    for (std::size_t i = 0; i < step_count; ++i)
+    {
+        auto& step = plan.steps_[i];
+        if (!step.layer_->concatenates_inputs())
+        {
+            continue;
+        }
+        for (std::size_t k = 0; k < step.inputs_.size(); ++k)
+        {
+            const auto& ref = step.inputs_[k];
+            const std::size_t producer = producers[ref.slot_idx_];
+            if (producer == step_count || reads[ref.slot_idx_] != 1 ||
+                ref.tensor_idx_ != 0 ||
+                !plan.steps_[producer].layer_->can_apply_into())
+            {
+                continue;
+            }
+            plan.steps_[producer].concat_destination_ =
+                fplus::just<concat_destination>({i, k});
+            step.in_place_inputs_.resize(step.inputs_.size(), false);
+            step.in_place_inputs_[k] = true;
+        }
+    }
+}
+
+// Layers whose output is a model output (and not read by other layers)
+// can write it directly into memory given by the caller.
+inline void mark_direct_outputs(execution_plan& plan)
+{
+    const std::size_t step_count = plan.steps_.size();
+    const auto producers = get_slot_producers(plan);
+    const auto reads = get_slot_read_counts(plan);
+    for (std::size_t i = 0; i < plan.outputs_.size(); ++i)
+    {
+        const auto& ref = plan.outputs_[i];
+        const std::size_t producer = producers[ref.slot_idx_];
+        if (producer != step_count && reads[ref.slot_idx_] == 1 &&
+            ref.tensor_idx_ == 0 &&
+            plan.steps_[producer].layer_->can_apply_into())
+        {
+            plan.steps_[producer].output_idx_ = fplus::just(i);
+        }
+    }
+}
+
+// Layers able to overwrite their input with their output do so
+// if the input is only read by them and its memory is not shared
+// with other tensors, e.g. because the layer producing it
+// returns new tensors.
+inline void mark_in_place_steps(execution_plan& plan)
+{
+    const std::size_t step_count = plan.steps_.size();
+    const auto producers = get_slot_producers(plan);
+    const auto reads = get_slot_read_counts(plan);
+    for (auto& step : plan.steps_)
+    {
+        if (step.inputs_.size() != 1 || !step.layer_->can_apply_in_place() ||
+            fplus::is_just(step.concat_destination_))
+        {
+            continue;
+        }
+        const auto& ref = step.inputs_.front();
+        const std::size_t producer = producers[ref.slot_idx_];
+        step.in_place_ = producer != step_count &&
+            reads[ref.slot_idx_] == 1 && ref.tensor_idx_ == 0 &&
+            (plan.steps_[producer].layer_->returns_new_tensors() ||
+                plan.steps_[producer].in_place_);
+    }
+}
+
+// Model inputs only read by layers able to read views are passed to them
+// as given, e.g. referring to memory of the caller, without copying.
+inline void mark_view_inputs(execution_plan& plan)
+{
+    plan.view_inputs_.assign(plan.input_slots_.size(), false);
+    for (std::size_t i = 0; i < plan.input_slots_.size(); ++i)
+    {
+        const std::size_t slot = plan.input_slots_[i];
+        const auto reads_slot = [slot](const tensor_ref& ref) -> bool
+        {
+            return ref.slot_idx_ == slot;
+        };
+        const auto readers = fplus::keep_if([&](const plan_step& step)
+        {
+            return fplus::any_by(reads_slot, step.inputs_);
+        }, plan.steps_);
+        plan.view_inputs_[i] = !readers.empty() &&
+            !fplus::any_by(reads_slot, plan.outputs_) &&
+            fplus::all_by([](const plan_step& step) -> bool
+            {
+                return step.inputs_.size() == 1 &&
+                    step.inputs_.front().tensor_idx_ == 0 &&
+                    fplus::is_nothing(step.concat_destination_) &&
+                    step.layer_->can_apply_to_views();
+            }, readers);
+        if (!plan.view_inputs_[i])
+        {
+            continue;
+        }
+        for (auto& step : plan.steps_)
+        {
+            if (fplus::any_by(reads_slot, step.inputs_))
+            {
+                step.input_view_idx_ = fplus::just(i);
+            }
+        }
+    }
+}
+
+inline execution_plan compile_execution_plan(const layer_ptrs& layers,
+    const node_connections& input_connections,
+    const node_connections& output_connections)
+{
+    std::map<std::string, layer_ptr> layers_by_name;
+    for (const auto& layer : layers)
+    {
+        layers_by_name[layer->name_] = layer;
+    }
+
+    using node_id = std::pair<std::string, std::size_t>;
+    std::map<node_id, std::size_t> slots;
+    execution_plan plan = {0, {}, {}, {}, {}};
+
+    for (const auto& conn : input_connections)
+    {
+        assertion(!fplus::map_contains(slots, conn.without_tensor_idx()),
+            "duplicate model input: " + conn.layer_id_);
+        slots[conn.without_tensor_idx()] = plan.slot_count_;
+        plan.input_slots_.push_back(plan.slot_count_++);
+    }
+
+    // Depth-first post-order traversal from the outputs yields
+    // the steps in an order valid for sequential execution.
+    std::function<tensor_ref(const node_connection&)> visit;
+    visit = [&](const node_connection& conn) -> tensor_ref
+    {
+        const auto id = conn.without_tensor_idx();
+        if (!fplus::map_contains(slots, id))
+        {
+            const auto layer = fplus::throw_on_nothing(
+                error("dangling layer reference: " + conn.layer_id_),
+                fplus::get_from_map(layers_by_name, conn.layer_id_));
+            const auto inputs = fplus::transform(visit,
+                layer->get_node(conn.node_idx_).inbound_connections());
+            slots[id] = plan.slot_count_;
+            plan.steps_.push_back(
+                {layer, inputs, plan.slot_count_++, {}, {}, {}, {}, {},
+                    false});
+        }
+        return {fplus::get_from_map_unsafe(slots, id), conn.tensor_idx_};
+    };
+
+    plan.outputs_ = fplus::transform(visit, output_connections);
+    mark_in_place_concatenations(plan);
+    mark_view_inputs(plan);
+    mark_direct_outputs(plan);
+    mark_in_place_steps(plan);
+
+    const auto lifetimes = get_slot_lifetimes(plan);
+    for (std::size_t slot = 0; slot < plan.slot_count_; ++slot)
+    {
+        if (lifetimes[slot].last_ < plan.steps_.size())
+        {
+            plan.steps_[lifetimes[slot].last_].released_slots_.push_back(slot);
+        }
+    }
+    return plan;
+}
+
+// Shapes of the tensors in each slot for model inputs of the given shapes.
+inline std::vector<shape3s> infer_plan_slot_shapes(const execution_plan& plan,
+    const shape3s& input_shapes)
+{
+    assertion(input_shapes.size() == plan.input_slots_.size(),
+        "invalid number of input shapes");
+    std::vector<shape3s> slot_shapes(plan.slot_count_);
+    for (std::size_t i = 0; i < input_shapes.size(); ++i)
+    {
+        slot_shapes[plan.input_slots_[i]] = {input_shapes[i]};
+    }
+    for (const auto& step : plan.steps_)
+    {
+        const auto step_input_shapes = fplus::transform(
+            [&slot_shapes](const tensor_ref& ref) -> shape3
+        {
+            const auto& shapes = slot_shapes[ref.slot_idx_];
+            assertion(ref.tensor_idx_ < shapes.size(), "invalid tensor index");
+            return shapes[ref.tensor_idx_];
+        }, step.inputs_);
+        slot_shapes[step.output_slot_] =
+            step.layer_->infer_output_shapes(step_input_shapes);
+    }
+    return slot_shapes;
+}
+
+inline shape3s infer_plan_output_shapes(const execution_plan& plan,
+    const shape3s& input_shapes)
+{
+    const auto slot_shapes = infer_plan_slot_shapes(plan, input_shapes);
+    return fplus::transform([&slot_shapes](const tensor_ref& ref) -> shape3
+    {
+        const auto& shapes = slot_shapes[ref.slot_idx_];
+        assertion(ref.tensor_idx_ < shapes.size(), "invalid tensor index");
+        return shapes[ref.tensor_idx_];
+    }, plan.outputs_);
+}
+
+// Lower bound of the number of values needed at the same time for the
+// tensors produced during a forward pass, which releases every slot
+// after its last use (see released_slots_), i.e. the largest sum of
+// the sizes of the slots alive during one step. Nothing enforces it:
+// the tensors are allocated individually, so allocator overhead comes
+// on top. The model inputs (owned by the caller) and the tensors inside
+// nested models are not counted.
+inline std::size_t activation_values_lower_bound(
+    const execution_plan& plan, const std::vector<shape3s>& slot_shapes)
+{
+    assertion(slot_shapes.size() == plan.slot_count_, "invalid slot shapes");
+    const auto lifetimes = get_slot_lifetimes(plan);
+
+    auto slot_sizes = fplus::transform([](const shape3s& shapes) -> std::size_t
+    {
+        return fplus::sum(fplus::transform(
+            fplus_c_mem_fn_t(shape3, volume, std::size_t), shapes));
+    }, slot_shapes);
+    for (const auto slot : plan.input_slots_)
+    {
+        slot_sizes[slot] = 0;
+    }
+    for (const auto& step : plan.steps_)
+    {
+        if (fplus::is_just(step.concat_destination_) || step.in_place_)
+        {
+            slot_sizes[step.output_slot_] = 0;
+        }
+    }
+
+    std::vector<std::size_t> alive(plan.steps_.size(), 0);
+    for (std::size_t slot = 0; slot < plan.slot_count_; ++slot)
+    {
+        const std::size_t last =
+            std::min(lifetimes[slot].last_ + 1, plan.steps_.size());
+        for (std::size_t i = lifetimes[slot].first_; i < last; ++i)
+        {
+            alive[i] += slot_sizes[slot];
+        }
+    }
+    return alive.empty() ? 0 :
+        *std::max_element(std::begin(alive), std::end(alive));
+}
+
+// The slots hold the tensors of all entries of the batch,
+// i.e. slots[slot_idx][batch_idx][tensor_idx].
+inline tensor3s_vec get_plan_tensors(const std::vector<tensor3s_vec>& slots,
+    const tensor_refs& refs, std::size_t batch_size)
+{
+    tensor3s_vec result(batch_size);
+    for (std::size_t i = 0; i < batch_size; ++i)
+    {
+        result[i].reserve(refs.size());
+        for (const auto& ref : refs)
+        {
+            const auto& tensors = slots[ref.slot_idx_][i];
+            assertion(ref.tensor_idx_ < tensors.size(),
+                "invalid tensor index");
+            result[i].push_back(tensors[ref.tensor_idx_]);
+        }
+    }
+    return result;
+}
+
+// Model inputs not read as views are copied into tensors
+// unless they already are ones.
+inline std::vector<tensor3s_vec> init_plan_slots(const execution_plan& plan,
+    const tensor3_views_vec& inputs)
+{
+    std::vector<tensor3s_vec> slots(plan.slot_count_);
+    for (std::size_t i = 0; i < plan.input_slots_.size(); ++i)
+    {
+        slots[plan.input_slots_[i]] = tensor3s_vec(inputs.size());
+    }
+    for (std::size_t b = 0; b < inputs.size(); ++b)
+    {
+        assertion(inputs[b].size() == plan.input_slots_.size(),
+            "invalid number of input tensors");
+        for (std::size_t i = 0; i < inputs[b].size(); ++i)
+        {
+            if (!plan.view_inputs_[i])
+            {
+                slots[plan.input_slots_[i]][b] =
+                    {tensor3_from_view(inputs[b][i])};
+            }
+        }
+    }
+    return slots;
+}
+
+// Output buffers of the concatenations written to in place
+// during one forward pass. A buffer is allocated when the first input
+// is written into it and handed over to the output tensors of the
+// concatenation, so it is not alive longer than needed.
+class concat_buffers
+{
+public:
+    concat_buffers(const execution_plan& plan,
+        const tensor3_views_vec& inputs)
+        : plan_(plan), batch_size_(inputs.size()), slot_shapes_(),
+        buffers_(plan.steps_.size()), mutex_()
+    {
+        const bool in_place = fplus::any_by([](const plan_step& step)
+        {
+            return !step.in_place_inputs_.empty();
+        }, plan.steps_);
+        if (!inputs.empty() && in_place)
+        {
+            slot_shapes_ = infer_plan_slot_shapes(plan, fplus::transform(
+                fplus_c_mem_fn_t(tensor3_view, shape, shape3),
+                inputs.front()));
+        }
+    }
+
+    // Where the producer of an input of a concatenation writes its output,
+    // one pointer per entry of the batch.
+    std::vector<float_type*> destinations(const concat_destination& dest)
+    {
+        const auto& step = plan_.steps_[dest.step_idx_];
+        std::size_t offset = 0;
+        for (std::size_t k = 0; k < dest.input_idx_; ++k)
+        {
+            offset += shape_of(step.inputs_[k]).volume();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& buffers = buffers_[dest.step_idx_];
+        if (buffers.empty())
+        {
+            const std::size_t volume =
+                shape_of({step.output_slot_, 0}).volume();
+            buffers = fplus::generate<std::vector<shared_float_vec>>([&]()
+            {
+                return fplus::make_shared_ref<float_vec>(volume);
+            }, batch_size_);
+        }
+        std::vector<float_type*> result;
+        result.reserve(buffers.size());
+        for (auto& buffer : buffers)
+        {
+            result.push_back(buffer->data() + offset);
+        }
+        return result;
+    }
+
+    // Copies the inputs not written in place into the output buffers
+    // and returns the output tensors of the concatenation.
+    tensor3s_vec concatenate(std::size_t step_idx,
+        const std::vector<tensor3s_vec>& slots)
+    {
+        const auto& step = plan_.steps_[step_idx];
+        const auto out_shape = shape_of({step.output_slot_, 0});
+        std::vector<shared_float_vec> buffers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(buffers, buffers_[step_idx]);
+        }
+        assertion(buffers.size() == batch_size_, "missing concat buffers");
+        tensor3s_vec result;
+        result.reserve(buffers.size());
+        for (std::size_t b = 0; b < buffers.size(); ++b)
+        {
+            float_type* dest = buffers[b]->data();
+            for (std::size_t k = 0; k < step.inputs_.size(); ++k)
+            {
+                const auto& ref = step.inputs_[k];
+                if (!step.in_place_inputs_[k])
+                {
+                    const auto& values = *slots[ref.slot_idx_][b]
+                        [ref.tensor_idx_].as_vector();
+                    std::copy(std::begin(values), std::end(values), dest);
+                }
+                dest += shape_of(ref).volume();
+            }
+            result.push_back({tensor3(storage_order_tag(), out_shape,
+                buffers[b])});
+        }
+        return result;
+    }
+
+    bool has_shapes() const
+    {
+        return !slot_shapes_.empty();
+    }
+
+    shape3 shape_of(const tensor_ref& ref) const
+    {
+        const auto& shapes = slot_shapes_[ref.slot_idx_];
+        assertion(ref.tensor_idx_ < shapes.size(), "invalid tensor index");
+        return shapes[ref.tensor_idx_];
+    }
+
+private:
+    const execution_plan& plan_;
+    std::size_t batch_size_;
+    std::vector<shape3s> slot_shapes_;
+    std::vector<std::vector<shared_float_vec>> buffers_;
+    std::mutex mutex_;
+};
+
+// Memory for the model outputs given by the caller,
+// i.e. destinations[batch_idx][output_idx].
+typedef std::vector<std::vector<float_type*>> output_destinations;
+
+// Applies the layer of a step, recording its costs if profiling.
+// Steps writing into a concatenation or into the output destinations
+// leave their output slot empty.
+inline tensor3s_vec apply_plan_step(const execution_plan& plan,
+    std::size_t step_idx, const std::vector<tensor3s_vec>& slots,
+    const tensor3_views_vec& inputs, concat_buffers& concats,
+    const output_destinations& destinations, profiler* prof)
+{
+    const std::size_t batch_size = inputs.size();
+    const auto& step = plan.steps_[step_idx];
+    const trace_span span(step.layer_->name_.c_str(),
+        step.layer_->type_.c_str());
+    const auto apply = [&]() -> tensor3s_vec
+    {
+        if (!destinations.empty() && fplus::is_just(step.output_idx_))
+        {
+            const std::size_t idx = step.output_idx_.unsafe_get_just();
+            step.layer_->apply_batch_into(
+                fplus::is_just(step.input_view_idx_) ?
+                    fplus::transform([&](const tensor3_views& views)
+                        -> tensor3s
+                    {
+                        return {tensor3_from_view(
+                            views[step.input_view_idx_.unsafe_get_just()])};
+                    }, inputs) :
+                    get_plan_tensors(slots, step.inputs_, batch_size),
+                fplus::transform(
+                    [idx](const std::vector<float_type*>& outputs)
+                        -> float_type*
+                {
+                    return outputs[idx];
+                }, destinations));
+            return tensor3s_vec(batch_size);
+        }
+        if (fplus::is_just(step.concat_destination_))
+        {
+            const auto& dest = step.concat_destination_.unsafe_get_just();
+            step.layer_->apply_batch_into(
+                get_plan_tensors(slots, step.inputs_, batch_size),
+                concats.destinations(dest));
+            return tensor3s_vec(batch_size);
+        }
+        if (!step.in_place_inputs_.empty())
+        {
+            return concats.concatenate(step_idx, slots);
+        }
+        if (step.in_place_)
+        {
+            return step.layer_->apply_batch_in_place(
+                get_plan_tensors(slots, step.inputs_, batch_size));
+        }
+        if (fplus::is_just(step.input_view_idx_))
+        {
+            const std::size_t idx = step.input_view_idx_.unsafe_get_just();
+            return step.layer_->apply_batch_to_views(fplus::transform(
+                [idx](const tensor3_views& views) -> tensor3_view
+            {
+                return views[idx];
+            }, inputs));
+        }
+        return step.layer_->apply_batch(
+            get_plan_tensors(slots, step.inputs_, batch_size));
+    };
+    if (prof == nullptr)
+    {
+        return apply();
+    }
+    // Nested models running on other threads profile their layers too.
+    const profiler_scope scope(prof);
+    const auto input_shapes = batch_size == 0 ? shape3s() : fplus::transform(
+        [&](const tensor_ref& ref) -> shape3
+    {
+        if (concats.has_shapes())
+            return concats.shape_of(ref);
+        if (fplus::is_just(step.input_view_idx_))
+            return inputs.front()[step.input_view_idx_.unsafe_get_just()]
+                .shape();
+        return slots[ref.slot_idx_].front()[ref.tensor_idx_].shape();
+    }, step.inputs_);
+    fplus::stopwatch stopwatch;
+    auto outputs = apply();
+    const double seconds = stopwatch.elapsed();
+    if (!outputs.empty())
+    {
+        const auto output_shapes = outputs.front().empty() ?
+            step.layer_->infer_output_shapes(input_shapes) :
+            fplus::transform(fplus_c_mem_fn_t(tensor3, shape, shape3),
+                outputs.front());
+        const bool allocates_outputs = !step.in_place_ &&
+            fplus::is_nothing(step.concat_destination_) &&
+            (destinations.empty() || fplus::is_nothing(step.output_idx_));
+        prof->record(step.layer_->name_, step.layer_->type_, seconds,
+            output_shapes, allocates_outputs, outputs.size(),
+            step.layer_->estimate_flops(input_shapes, output_shapes));
+    }
+    return outputs;
+}
+
+// Returns the model outputs, or, if destinations are given, copies
+// the ones not already written there and returns nothing.
+inline tensor3s_vec get_plan_outputs(const execution_plan& plan,
+    const std::vector<tensor3s_vec>& slots,
+    const output_destinations& destinations, std::size_t batch_size)
+{
+    if (destinations.empty())
+    {
+        return get_plan_tensors(slots, plan.outputs_, batch_size);
+    }
+    assertion(destinations.size() == batch_size,
+        "invalid number of output destinations");
+    std::vector<bool> written(plan.outputs_.size(), false);
+    for (const auto& step : plan.steps_)
+    {
+        if (fplus::is_just(step.output_idx_))
+        {
+            written[step.output_idx_.unsafe_get_just()] = true;
+        }
+    }
+    for (std::size_t b = 0; b < batch_size; ++b)
+    {
+        assertion(destinations[b].size() == plan.outputs_.size(),
+            "invalid number of output destinations");
+        for (std::size_t i = 0; i < plan.outputs_.size(); ++i)
+        {
+            if (written[i])
+            {
+                continue;
+            }
+            const auto& ref = plan.outputs_[i];
+            const auto& tensors = slots[ref.slot_idx_][b];
+            assertion(ref.tensor_idx_ < tensors.size(),
+                "invalid tensor index");
+            const auto& values = *tensors[ref.tensor_idx_].as_vector();
+            std::copy(std::begin(values), std::end(values),
+                destinations[b][i]);
+        }
+    }
+    return {};
+}
+
+// Runs the plan for a batch of inputs.
+// Every layer is applied to all entries of the batch at once.
+// If destinations are given, the outputs are written there
+// instead of being returned.
+inline tensor3s_vec run_execution_plan(const execution_plan& plan,
+    const tensor3_views_vec& inputs,
+    const output_destinations& destinations = {})
+{
+    auto slots = init_plan_slots(plan, inputs);
+    concat_buffers concats(plan, inputs);
+    profiler* const prof = current_profiler();
+    for (std::size_t i = 0; i < plan.steps_.size(); ++i)
+    {
+        const auto& step = plan.steps_[i];
+        slots[step.output_slot_] = apply_plan_step(plan, i, slots, inputs,
+            concats, destinations, prof);
+        for (const auto slot : step.released_slots_)
+        {
+            slots[slot].clear();
+        }
+    }
+    return get_plan_outputs(plan, slots, destinations, inputs.size());
+}
+
+inline tensor3s_vec run_execution_plan(const execution_plan& plan,
+    const tensor3s_vec& inputs)
+{
+    return run_execution_plan(plan,
+        fplus::transform(tensor3_views_of, inputs));
+}
+
+inline tensor3s run_execution_plan(const execution_plan& plan,
+    const tensor3s& inputs)
+{
+    return run_execution_plan(plan, tensor3s_vec(1, inputs)).front();
+}
+
+// Runs every step as soon as all its inputs are available,
+// so independent branches of the graph are computed concurrently.
+// Slots are freed once all their readers are done.
+inline tensor3s_vec run_execution_plan_parallel(const execution_plan& plan,
+    const tensor3_views_vec& inputs, thread_pool& pool,
+    const output_destinations& destinations = {})
+{
+    auto slots = init_plan_slots(plan, inputs);
+    concat_buffers concats(plan, inputs);
+
+    const std::size_t step_count = plan.steps_.size();
+    const auto producers = get_slot_producers(plan);
+
+    std::vector<std::vector<std::size_t>> step_input_slots(step_count);
+    std::vector<std::vector<std::size_t>> dependents(step_count);
+    std::vector<std::size_t> missing_inputs(step_count, 0);
+    std::vector<std::size_t> readers(plan.slot_count_, 0);
+    for (std::size_t i = 0; i < step_count; ++i)
+    {
+        step_input_slots[i] = fplus::nub(fplus::transform(
+            [](const tensor_ref& ref) -> std::size_t
+        {
+            return ref.slot_idx_;
+        }, plan.steps_[i].inputs_));
+        for (const auto slot : step_input_slots[i])
+        {
+            ++readers[slot];
+            if (producers[slot] != step_count)
+            {
+                ++missing_inputs[i];
+                dependents[producers[slot]].push_back(i);
+            }
+        }
+    }
+    for (const auto& ref : plan.outputs_)
+    {
+        ++readers[ref.slot_idx_];
+    }
+
+    profiler* const prof = current_profiler();
+    std::mutex mutex;
+    task_group tasks(pool);
+    std::function<void(std::size_t)> run_step;
+    run_step = [&](std::size_t i)
+    {
+        const auto& step = plan.steps_[i];
+        auto result = apply_plan_step(plan, i, slots, inputs, concats,
+            destinations, prof);
+
+        std::vector<std::size_t> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slots[step.output_slot_] = std::move(result);
+            for (const auto slot : step_input_slots[i])
+            {
+                if (--readers[slot] == 0)
+                {
+                    slots[slot].clear();
+                }
+            }
+            for (const auto dependent : dependents[i])
+            {
+                if (--missing_inputs[dependent] == 0)
+                {
+                    ready.push_back(dependent);
+                }
+            }
+        }
+        for (const auto dependent : ready)
+        {
+            tasks.run([&run_step, dependent]() { run_step(dependent); });
+        }
+    };
+
+    const auto initial_steps = fplus::keep_if([&](std::size_t i) -> bool
+    {
+        return missing_inputs[i] == 0;
+    }, fplus::numbers<std::size_t>(0, step_count));
+    for (const auto i : initial_steps)
+    {
+        tasks.run([&run_step, i]() { run_step(i); });
+    }
+    tasks.wait();
+
+    return get_plan_outputs(plan, slots, destinations, inputs.size());
+}
+
+inline tensor3s_vec run_execution_plan_parallel(const execution_plan& plan,
+    const tensor3s_vec& inputs, thread_pool& pool)
+{
+    return run_execution_plan_parallel(plan,
+        fplus::transform(tensor3_views_of, inputs), pool);
+}
+
+inline tensor3s run_execution_plan_parallel(const execution_plan& plan,
+    const tensor3s& inputs, thread_pool& pool)
+{
+    return run_execution_plan_parallel(
+        plan, tensor3s_vec(1, inputs), pool).front();
+}
+
+} } // namespace fdeep, namespace internal
@@ -6,14 +6,20 @@
 
 #pragma once
 
+#include "fdeep/buffer_pool.hpp"
 #include "fdeep/common.hpp"
 
 #include "fdeep/convolution.hpp"
+#include "fdeep/execution_plan.hpp"
 #include "fdeep/filter.hpp"
+#include "fdeep/micro_batcher.hpp"
+#include "fdeep/profiling.hpp"
 #include "fdeep/tensor2.hpp"
 #include "fdeep/tensor2_pos.hpp"
 #include "fdeep/tensor3.hpp"
 #include "fdeep/tensor3_pos.hpp"
+#include "fdeep/thread_pool.hpp"
+#include "fdeep/tracing.hpp"
 #include "fdeep/node.hpp"
 #include "fdeep/shape2.hpp"
 #include "fdeep/shape3.hpp"
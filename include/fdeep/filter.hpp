@@ -48,7 +48,7 @@ public:
     {
         assertion(weights.size() == m_.shape().volume(),
             "invalid parameter count");
-        m_ = tensor3(m_.shape(), float_vec(weights));
+        m_ = tensor3_from_depth_first_values(m_.shape(), float_vec(weights));
         bias_ = bias;
     }
 private:
@@ -80,8 +80,8 @@ inline float_vec decode_floats(const nlohmann::json& data)
 
     if (data.is_array() && !data.empty() && data[0].is_number())
     {
-        const float_vec result = data;
-        return result;
+        const std::vector<float_type> result = data;
+        return float_vec(result.begin(), result.end());
     }
 
     assertion(std::numeric_limits<float>::is_iec559,
@@ -105,7 +105,8 @@ inline float_vec decode_floats(const nlohmann::json& data)
 inline tensor3 create_tensor3(const nlohmann::json& data)
 {
     const shape3 shape = create_shape3(data["shape"]);
-    return tensor3(shape, decode_floats(data["values"]));
+    return tensor3_from_depth_first_values(shape,
+        decode_floats(data["values"]));
 }
 
 template <typename T, typename F>
@@ -138,13 +139,82 @@ using get_global_param_f = std::function<nlohmann::json(const std::string&)>;
 layer_ptr create_layer(const get_param_f&, const get_global_param_f&,
     const nlohmann::json&);
 
-inline layer_ptr create_model_layer(const get_param_f& get_param,
+// Graph rewrite: A BatchNormalization layer applied to the output
+// of a Conv2D, Dense or SeparableConv2D layer (used nowhere else)
+// is merged into the weights of that layer and dropped.
+inline void fold_batch_normalization_layers(layer_ptrs& layers,
+    node_connections& outputs)
+{
+    const auto count_uses = [&](const std::string& layer_id) -> std::size_t
+    {
+        const auto refers_to_layer = [&](const node_connection& conn) -> bool
+        {
+            return conn.layer_id_ == layer_id;
+        };
+        std::size_t result = fplus::count_if(refers_to_layer, outputs);
+        for (const auto& l : layers)
+        {
+            for (const auto& n : l->nodes_)
+            {
+                result += fplus::count_if(refers_to_layer,
+                    n.inbound_connections());
+            }
+        }
+        return result;
+    };
+
+    for (const auto& bn_layer : layer_ptrs(layers))
+    {
+        const auto bn =
+            std::dynamic_pointer_cast<batch_normalization_layer>(bn_layer);
+        if (bn == nullptr || bn->nodes_.size() != 1 ||
+            bn->nodes_.front().inbound_connections().size() != 1)
+        {
+            continue;
+        }
+        const node_connection input =
+            bn->nodes_.front().inbound_connections().front();
+        const auto producers = fplus::keep_if([&](const layer_ptr& l) -> bool
+        {
+            return l->name_ == input.layer_id_;
+        }, layers);
+        if (producers.size() != 1 || producers.front()->nodes_.size() != 1 ||
+            count_uses(input.layer_id_) != 1 ||
+            !producers.front()->fold_output_scale_shift(
+                bn->scale(), bn->shift()))
+        {
+            continue;
+        }
+
+        const auto rewire = [&](const node_connection& conn) -> node_connection
+        {
+            return conn.layer_id_ == bn->name_ ?
+                node_connection(input.layer_id_, input.node_idx_,
+                    conn.tensor_idx_) :
+                conn;
+        };
+        for (const auto& l : layers)
+        {
+            l->set_nodes(fplus::transform([&](const node& n) -> node
+            {
+                return node(fplus::transform(rewire, n.inbound_connections()));
+            }, l->nodes_));
+        }
+        outputs = fplus::transform(rewire, outputs);
+        layers = fplus::drop_if([&](const layer_ptr& l) -> bool
+        {
+            return l == bn_layer;
+        }, layers);
+    }
+}
+
+inline model_layer_ptr create_model_layer(const get_param_f& get_param,
     const get_global_param_f& get_global_param, const nlohmann::json& data,
     const std::string& name)
 {
     assertion(data["config"]["layers"].is_array(), "missing layers array");
 
-    const auto layers = create_vector<layer_ptr>(
+    auto layers = create_vector<layer_ptr>(
         fplus::bind_1st_and_2nd_of_3(create_layer, get_param, get_global_param),
         data["config"]["layers"]);
 
@@ -153,9 +223,11 @@ inline layer_ptr create_model_layer(const get_param_f& get_param,
     const auto inputs = create_vector<node_connection>(
         create_node_connection, data["config"]["input_layers"]);
 
-    const auto outputs = create_vector<node_connection>(
+    auto outputs = create_vector<node_connection>(
         create_node_connection, data["config"]["output_layers"]);
 
+    fold_batch_normalization_layers(layers, outputs);
+
     return std::make_shared<model_layer>(name, layers, inputs, outputs);
 }
 
@@ -708,14 +780,17 @@ inline layer_ptr create_layer(const get_param_f& get_param,
         fplus::get_from_map(creators, type))(
             get_param, get_global_param, data, name);
 
+    // A linear activation is the identity, so it is not attached at all.
     if (type != "Activation" &&
-        json_obj_has_member(data["config"], "activation"))
+        json_obj_has_member(data["config"], "activation") &&
+        data["config"]["activation"] != "linear")
     {
         result->set_activation(
             create_activation_layer_type_name(get_param, get_global_param, data,
                 data["config"]["activation"], ""));
     }
 
+    result->set_type(type);
     result->set_nodes(create_nodes(data));
 
     return result;
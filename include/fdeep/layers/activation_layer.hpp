@@ -10,8 +10,10 @@
 
 #include <fplus/fplus.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <utility>
 #include <vector>
 
 namespace fdeep { namespace internal
@@ -26,6 +28,10 @@ public:
         layer(name)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        return input_shapes;
+    }
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
         const auto f = [this](const tensor3& t) -> tensor3
@@ -35,6 +41,50 @@ public:
         return fplus::transform(f, inputs);
     }
 
+    bool can_apply_into() const override
+    {
+        return true;
+    }
+    void apply_batch_into(const tensor3s_vec& inputs,
+        const std::vector<float_type*>& destinations) const override
+    {
+        const auto batch = single_tensor_batch_inputs(inputs);
+        assertion(destinations.size() == batch.size(),
+            "invalid destination count");
+        for (std::size_t i = 0; i < batch.size(); ++i)
+        {
+            const auto& values = *batch[i].as_vector();
+            std::copy(std::begin(values), std::end(values), destinations[i]);
+            const std::size_t area =
+                batch[i].shape().height_ * batch[i].shape().width_;
+            transform_in_place(
+                {destinations[i], batch[i].shape().depth_, area, 0, area});
+        }
+    }
+
+    bool can_apply_in_place() const override
+    {
+        return true;
+    }
+    tensor3s_vec apply_batch_in_place(tensor3s_vec&& inputs) const override
+    {
+        for (auto& input : inputs)
+        {
+            assertion(input.size() == 1, "only one input tensor allowed");
+            transform_in_place(tensor3_pixel_block(input.front()));
+        }
+        return std::move(inputs);
+    }
+
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
+
+    // Applies the activation function in place.
+    // Used by layers fusing their activation into their output computation.
+    virtual void transform_in_place(const pixel_block& block) const = 0;
+
 protected:
     virtual tensor3 transform_input(const tensor3& input) const = 0;
 };
@@ -46,4 +96,14 @@ inline tensor3s apply_activation_layer(
     return ptr == nullptr ? input : ptr->apply(input);
 }
 
+inline void apply_activation_layer_in_place(
+    const activation_layer_ptr& ptr,
+    const pixel_block& block)
+{
+    if (ptr != nullptr)
+    {
+        ptr->transform_in_place(block);
+    }
+}
+
 } } // namespace fdeep, namespace internal
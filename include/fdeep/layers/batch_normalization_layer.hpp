@@ -8,6 +8,8 @@
 
 #include "fdeep/layers/layer.hpp"
 
+#include <utility>
+
 namespace fdeep { namespace internal
 {
 
@@ -23,59 +25,121 @@ public:
         const float_vec& gamma,
         float_type epsilon)
         : layer(name),
-        moving_mean_(moving_mean),
-        moving_variance_(moving_variance),
-        beta_(beta),
-        gamma_(gamma),
-        epsilon_(epsilon)
+        scale_(generate_scale(moving_variance, gamma, epsilon)),
+        shift_(generate_shift(moving_mean, beta, scale_))
+    {
+    }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "invalid number of tensors");
+        return input_shapes;
+    }
+    // The normalization boils down to output = input * scale + shift
+    // per channel, with these values computed once at load time.
+    const float_vec& scale() const
+    {
+        return scale_;
+    }
+    const float_vec& shift() const
+    {
+        return shift_;
+    }
+    bool can_apply_in_place() const override
     {
+        return true;
+    }
+    tensor3s_vec apply_batch_in_place(tensor3s_vec&& inputs) const override
+    {
+        for (auto& input : inputs)
+        {
+            assertion(input.size() == 1, "invalid number of tensors");
+            auto& tensor = input.front();
+            float_type* const values = tensor.as_vector()->data();
+            scale_and_shift(tensor.shape(), values, values);
+            apply_activation_layer_in_place(activation_,
+                tensor3_pixel_block(tensor));
+        }
+        return std::move(inputs);
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
     }
 protected:
-    float_vec moving_mean_;
-    float_vec moving_variance_;
-    float_vec beta_;
-    float_vec gamma_;
-    float_type epsilon_;
-
-    tensor3 apply_to_slices(const tensor3& input) const
+    static float_vec generate_scale(const float_vec& moving_variance,
+        const float_vec& gamma, float_type epsilon)
     {
-        assertion(moving_mean_.size() == input.shape().depth_,
-            "invalid beta");
-        assertion(moving_variance_.size() == input.shape().depth_,
-            "invalid beta");
-
-        const bool use_gamma = !gamma_.empty();
+        const bool use_gamma = !gamma.empty();
         if (use_gamma)
         {
-            assertion(gamma_.size() == input.shape().depth_, "invalid gamma");
+            assertion(gamma.size() == moving_variance.size(), "invalid gamma");
         }
-
-        const bool use_beta = !beta_.empty();
+        float_vec scale(moving_variance.size());
+        for (std::size_t z = 0; z < scale.size(); ++z)
+        {
+            const float_type denom = std::sqrt(moving_variance[z] + epsilon);
+            scale[z] = (use_gamma ? gamma[z] : 1) / denom;
+        }
+        return scale;
+    }
+    static float_vec generate_shift(const float_vec& moving_mean,
+        const float_vec& beta, const float_vec& scale)
+    {
+        assertion(moving_mean.size() == scale.size(), "invalid moving mean");
+        const bool use_beta = !beta.empty();
         if (use_beta)
         {
-            assertion(beta_.size() == input.shape().depth_, "invalid beta");
+            assertion(beta.size() == scale.size(), "invalid beta");
         }
+        float_vec shift(scale.size());
+        for (std::size_t z = 0; z < shift.size(); ++z)
+        {
+            shift[z] = (use_beta ? beta[z] : 0) - moving_mean[z] * scale[z];
+        }
+        return shift;
+    }
+
+    float_vec scale_;
+    float_vec shift_;
 
-        tensor3 output(input.shape(), 0);
-        for (std::size_t z = 0; z < output.shape().depth_; ++z)
+    // Writes input * scale + shift per channel to output,
+    // which may be the same memory as input.
+    void scale_and_shift(const shape3& shape,
+        const float_type* input, float_type* output) const
+    {
+        assertion(scale_.size() == shape.depth_, "invalid input depth");
+        const std::size_t area = shape.height_ * shape.width_;
+        if (channels_last_layout)
         {
-            const float_type denom = std::sqrt(moving_variance_[z] + epsilon_);
-            for (std::size_t y = 0; y < output.shape().height_; ++y)
+            const std::size_t depth = shape.depth_;
+            const std::size_t volume = shape.volume();
+            for (std::size_t i = 0; i < volume; i += depth)
             {
-                for (std::size_t x = 0; x < output.shape().width_; ++x)
+                for (std::size_t z = 0; z < depth; ++z)
                 {
-                    float_type val = input.get(z, y, x);
-                    val -= moving_mean_[z];
-                    if (use_gamma)
-                        val *= gamma_[z];
-                    val /= denom;
-                    if (use_beta)
-                        val += beta_[z];
-                    output.set(z, y, x, val);
+                    output[i + z] = input[i + z] * scale_[z] + shift_[z];
                 }
             }
+            return;
+        }
+        for (std::size_t z = 0; z < shape.depth_; ++z)
+        {
+            const float_type scale = scale_[z];
+            const float_type shift = shift_[z];
+            for (std::size_t i = z * area; i < (z + 1) * area; ++i)
+            {
+                output[i] = input[i] * scale + shift;
+            }
         }
-        return output;
+    }
+
+    tensor3 apply_to_slices(const tensor3& input) const
+    {
+        float_vec output_values(input.shape().volume());
+        scale_and_shift(input.shape(), input.as_vector()->data(),
+            output_values.data());
+        return tensor3(storage_order_tag(), input.shape(),
+            std::move(output_values));
     }
 
     tensor3s apply_impl(const tensor3s& inputs) const override
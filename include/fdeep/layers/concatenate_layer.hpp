@@ -18,6 +18,23 @@ public:
         : layer(name)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(!input_shapes.empty(), "no tensors to concatenate");
+        const std::size_t depth_sum = fplus::sum(fplus::transform(
+            [](const shape3& s) -> std::size_t { return s.depth_; },
+            input_shapes));
+        return {shape3(depth_sum,
+            input_shapes.front().height_, input_shapes.front().width_)};
+    }
+    bool concatenates_inputs() const override
+    {
+        return true;
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& input) const override
     {
@@ -46,17 +46,89 @@ public:
         assertion(filter_shape.volume() > 0, "filter must have volume");
         assertion(strides.area() > 0, "invalid strides");
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "only one input tensor allowed");
+        const auto conv_cfg = preprocess_convolution(
+            filters_.filter_shape_.without_depth(),
+            strides_, padding_, false, input_shapes.front());
+        return {shape3(filters_.filter_count_,
+            conv_cfg.out_height_, conv_cfg.out_width_)};
+    }
+    // One multiply-add per filter value for every output value.
+    std::size_t estimate_flops(const shape3s&,
+        const shape3s& output_shapes) const override
+    {
+        return 2 * output_shapes.front().volume() *
+            filters_.filter_shape_.volume();
+    }
+    bool fold_output_scale_shift(const float_vec& scale,
+        const float_vec& shift) override
+    {
+        if (activation_ != nullptr || scale.size() != filters_.filter_count_)
+        {
+            return false;
+        }
+        fold_scale_shift_into_im2col_filter_matrix(filters_, scale, shift);
+        return true;
+    }
+    tensor3s_vec apply_batch(const tensor3s_vec& inputs) const override
+    {
+        if (inputs.empty())
+        {
+            return {};
+        }
+        return single_tensor_batch_outputs(convolve_batch(
+            single_tensor_batch_views(inputs), {}));
+    }
+    bool can_apply_to_views() const override
+    {
+        return true;
+    }
+    tensor3s_vec apply_batch_to_views(const tensor3_views& inputs)
+        const override
+    {
+        if (inputs.empty())
+        {
+            return {};
+        }
+        return single_tensor_batch_outputs(convolve_batch(inputs, {}));
+    }
+    bool can_apply_into() const override
+    {
+        return true;
+    }
+    void apply_batch_into(const tensor3s_vec& inputs,
+        const std::vector<float_type*>& destinations) const override
+    {
+        if (!inputs.empty())
+        {
+            convolve_batch(single_tensor_batch_views(inputs), destinations);
+        }
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
-        assertion(inputs.size() == 1, "only one input tensor allowed");
+        return apply_batch({inputs}).front();
+    }
+    bool fuses_activation() const override
+    {
+        return true;
+    }
+    tensor3s convolve_batch(const tensor3_views& inputs,
+        const std::vector<float_type*>& destinations) const
+    {
         const bool use_offset = inputs.front().shape().depth_ == 1 ?
             ((padding_ == padding::valid && padding_valid_offset_depth_1_) ||
             (padding_ == padding::same && padding_same_offset_depth_1_)) :
             ((padding_ == padding::valid && padding_valid_offset_depth_2_) ||
             (padding_ == padding::same && padding_same_offset_depth_2_));
-        return {convolve(strides_, padding_, use_offset,
-            filters_, inputs.front())};
+        return convolve(strides_, padding_, use_offset, filters_, inputs,
+            fused_activation(), destinations);
     }
     im2col_filter_matrix filters_;
     shape2 strides_;
@@ -45,6 +45,15 @@ public:
         assertion(filter_shape.volume() > 0, "filter must have volume");
         assertion(strides.area() > 0, "invalid strides");
     }
+    shape3s infer_output_shapes(const shape3s&) const override
+    {
+        raise_error("conv_2d_transpose_layer not yet implemented");
+        return {};
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
@@ -26,6 +26,14 @@ public:
             right_crop_(right_crop)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "invalid number of input tensors");
+        const auto& in = input_shapes.front();
+        return {shape3(in.depth_,
+            in.height_ - (top_crop_ + bottom_crop_),
+            in.width_ - (left_crop_ + right_crop_))};
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
@@ -9,9 +9,14 @@
 #include "fdeep/layers/layer.hpp"
 
 #include "fdeep/tensor2.hpp"
+#include "fdeep/thread_pool.hpp"
 
 #include <fplus/fplus.hpp>
 
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
 namespace fdeep { namespace internal
 {
 
@@ -19,52 +24,152 @@ namespace fdeep { namespace internal
 class dense_layer : public layer
 {
 public:
-    static RowMajorMatrixXf generate_params(std::size_t n_in,
-        const float_vec& weights, const float_vec& bias)
-    {
-        assertion(weights.size() % bias.size() == 0, "invalid params");
-        return eigen_mat_from_values(n_in + 1, bias.size(),
-            fplus::append(weights, bias));
-    }
     dense_layer(const std::string& name, std::size_t units,
             const float_vec& weights,
             const float_vec& bias) :
         layer(name),
         n_in_(weights.size() / bias.size()),
         n_out_(units),
-        params_(generate_params(n_in_, weights, bias))
+        params_(eigen_mat_from_values(n_in_, n_out_, weights)),
+        biases_(bias)
     {
         assertion(bias.size() == units, "invalid bias count");
         assertion(weights.size() % units == 0, "invalid weight count");
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "invalid number of input tensors");
+        return {shape3(n_out_, 1, 1)};
+    }
+    std::size_t estimate_flops(const shape3s&, const shape3s&) const override
+    {
+        return 2 * n_in_ * n_out_;
+    }
+    bool fold_output_scale_shift(const float_vec& scale,
+        const float_vec& shift) override
+    {
+        if (activation_ != nullptr || scale.size() != n_out_)
+        {
+            return false;
+        }
+        for (std::size_t i = 0; i < n_out_; ++i)
+        {
+            params_.col(static_cast<Eigen::Index>(i)) *= scale[i];
+            biases_[i] = biases_[i] * scale[i] + shift[i];
+        }
+        return true;
+    }
+    tensor3s_vec apply_batch(const tensor3s_vec& inputs) const override
+    {
+        // The outputs are copied from the finished rows
+        // instead of being filled with zeros first.
+        const scratch_buffer output_values(inputs.size() * n_out_);
+        multiply_batch(inputs, output_values.data());
+        tensor3s results;
+        results.reserve(inputs.size());
+        for (std::size_t i = 0; i < inputs.size(); ++i)
+        {
+            const float_type* row = output_values.data() + i * n_out_;
+            results.push_back(tensor3(storage_order_tag(),
+                shape3(n_out_, 1, 1), float_vec(row, row + n_out_)));
+        }
+        return single_tensor_batch_outputs(results);
+    }
+    bool can_apply_into() const override
+    {
+        return true;
+    }
+    void apply_batch_into(const tensor3s_vec& inputs,
+        const std::vector<float_type*>& destinations) const override
+    {
+        assertion(destinations.size() == inputs.size(),
+            "invalid destination count");
+        if (inputs.size() == 1)
+        {
+            multiply_batch(inputs, destinations.front());
+            return;
+        }
+        const scratch_buffer output_values(inputs.size() * n_out_);
+        multiply_batch(inputs, output_values.data());
+        for (std::size_t i = 0; i < inputs.size(); ++i)
+        {
+            const float_type* row = output_values.data() + i * n_out_;
+            std::copy(row, row + n_out_, destinations[i]);
+        }
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
-        assertion(inputs.size() == 1, "invalid number of input tensors");
-        auto input = inputs.front();
-        assertion(input.shape().width_ == 1 && input.shape().height_ == 1,
-            "input not flattened");
-        const auto bias_padded_input = bias_pad_input(input);
-        const auto result = bias_padded_input * params_;
-        assertion(result.rows() == 1, "invalid result size");
-        return {tensor3(shape3(static_cast<std::size_t>(result.cols()), 1, 1),
-            eigen_mat_to_values(result))};
+        return apply_batch({inputs}).front();
     }
-    static RowMajorMatrixXf bias_pad_input(const tensor3& input)
+    bool fuses_activation() const override
     {
-        assertion(input.shape().width_ == 1 && input.shape().height_ == 1,
-            "tensor not flattened");
-        RowMajorMatrixXf m(1, input.shape().depth_ + 1);
-        for (std::size_t z = 0; z < input.shape().depth_; ++z)
+        return true;
+    }
+    // Writes the output values of all entries of the batch,
+    // with bias and activation, row by row to out.
+    void multiply_batch(const tensor3s_vec& inputs, float_type* out) const
+    {
+        if (inputs.empty())
+        {
+            return;
+        }
+        const auto batch = single_tensor_batch_inputs(inputs);
+        const std::size_t n = batch.size();
+        for (const auto& input : batch)
+        {
+            assertion(input.shape().width_ == 1 && input.shape().height_ == 1,
+                "input not flattened");
+            assertion(input.shape().depth_ == n_in_, "invalid input size");
+        }
+        // All entries of the batch are multiplied in one go, row by row.
+        // A single entry is read from its tensor directly.
+        const scratch_buffer input_values(n > 1 ? n * n_in_ : 0);
+        if (n > 1)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                const auto& values = *batch[i].as_vector();
+                std::copy(std::begin(values), std::end(values),
+                    input_values.data() + i * n_in_);
+            }
+        }
+        const Eigen::Map<const RowMajorMatrixXf, Eigen::Aligned64> input_mat(
+            n > 1 ? input_values.data() : batch.front().as_vector()->data(),
+            static_cast<Eigen::Index>(n), static_cast<Eigen::Index>(n_in_));
+        Eigen::Map<RowMajorMatrixXf> out_mat(out,
+            static_cast<Eigen::Index>(n), static_cast<Eigen::Index>(n_out_));
+        // Large layers are split into blocks of output neurons
+        // (of at least 32768 weights each) to be computed in parallel.
+        const std::size_t thread_count = parallel_op_thread_count();
+        const std::size_t block_size = std::max<std::size_t>(
+            (n_out_ + thread_count - 1) / thread_count,
+            std::max<std::size_t>(16, 32768 / std::max<std::size_t>(1, n_in_)));
+        parallel_for((n_out_ + block_size - 1) / block_size,
+            [&](std::size_t block_idx)
+        {
+            const std::size_t first = block_idx * block_size;
+            const auto first_col = static_cast<Eigen::Index>(first);
+            const auto cols = static_cast<Eigen::Index>(
+                std::min(block_size, n_out_ - first));
+            const trace_span span("GEMM", "dense");
+            out_mat.middleCols(first_col, cols).noalias() =
+                input_mat * params_.middleCols(first_col, cols);
+        });
+        for (std::size_t i = 0; i < n; ++i)
         {
-            m(0, static_cast<Eigen::Index>(z)) = input.get(tensor3_pos(z, 0, 0));
+            finish_pixel_block(biases_, fused_activation(),
+                {out + i * n_out_, n_out_, 1, 0, 1});
         }
-        m(0, static_cast<Eigen::Index>(input.shape().depth_)) = 1;
-        return m;
     }
     std::size_t n_in_;
     std::size_t n_out_;
     RowMajorMatrixXf params_;
+    float_vec biases_;
 };
 
 } } // namespace fdeep, namespace internal
@@ -18,6 +18,12 @@ public:
         : activation_layer(name), alpha_(alpha)
     {
     }
+    void transform_in_place(const pixel_block& block) const override
+    {
+        transform_pixel_block_values(
+            fplus::bind_1st_of_2(activation_function, alpha_),
+            block);
+    }
 protected:
     float_type alpha_;
     static float_type activation_function(float_type alpha, float_type x)
@@ -19,6 +19,15 @@ public:
             layer(name)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "invalid number of input tensors");
+        return {shape3(input_shapes.front().volume(), 1, 1)};
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
@@ -18,6 +18,10 @@ public:
         : layer(name), input_shape_(input_shape), output_()
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        return input_shapes;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
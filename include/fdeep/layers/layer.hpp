@@ -26,12 +26,14 @@ class activation_layer;
 typedef std::shared_ptr<activation_layer> activation_layer_ptr;
 tensor3s apply_activation_layer(const activation_layer_ptr& ptr,
     const tensor3s& input);
+void apply_activation_layer_in_place(const activation_layer_ptr& ptr,
+    const pixel_block& block);
 
 class layer
 {
 public:
     explicit layer(const std::string& name)
-        : name_(name), nodes_(), activation_(nullptr)
+        : name_(name), type_(), nodes_(), activation_(nullptr)
     {
     }
     virtual ~layer()
@@ -43,6 +45,12 @@ public:
         activation_ = activation;
     }
 
+    // The Keras class name, e.g. "Conv2D".
+    void set_type(const std::string& type)
+    {
+        type_ = type;
+    }
+
     void set_nodes(const nodes& layer_nodes)
     {
         nodes_ = layer_nodes;
@@ -51,64 +59,159 @@ public:
     virtual tensor3s apply(const tensor3s& input) const final
     {
         const auto result = apply_impl(input);
-        if (activation_ == nullptr)
+        if (activation_ == nullptr || fuses_activation())
             return result;
         else
             return apply_activation_layer(activation_, result);
     }
 
-    virtual tensor3 get_output(const layer_ptrs& layers,
-        output_dict& output_cache,
-        std::size_t node_idx, std::size_t tensor_idx) const
+    // Applies the layer to every entry of a batch.
+    // Layers able to process a whole batch at once (e.g. with one GEMM
+    // instead of one per entry) override this.
+    virtual tensor3s_vec apply_batch(const tensor3s_vec& inputs) const
     {
-        const node_connection conn(name_, node_idx, tensor_idx);
-
-        if (!fplus::map_contains(output_cache, conn.without_tensor_idx()))
+        return fplus::transform([this](const tensor3s& input) -> tensor3s
         {
-            assertion(node_idx < nodes_.size(), "invalid node index");
-            output_cache[conn.without_tensor_idx()] =
-                nodes_[node_idx].get_output(layers, output_cache, *this);
-        }
+            return apply(input);
+        }, inputs);
+    }
+
+    // Layers returning exactly one tensor that can write it into memory
+    // given by the caller, e.g. the output buffer of a following
+    // concatenation, return true and override apply_batch_into.
+    virtual bool can_apply_into() const
+    {
+        return false;
+    }
 
-        const auto& outputs = fplus::get_from_map_unsafe(
-            output_cache, conn.without_tensor_idx());
+    // Like apply_batch, but writes the output of entry i
+    // to destinations[i] instead of returning it.
+    virtual void apply_batch_into(const tensor3s_vec&,
+        const std::vector<float_type*>&) const
+    {
+        assertion(false, "layer can not write into given memory");
+    }
 
-        assertion(tensor_idx < outputs.size(),
-            "invalid tensor index");
-        return outputs[tensor_idx];
+    // Layers taking exactly one tensor that can read it through
+    // a tensor3_view, e.g. referring to memory owned by the caller,
+    // return true and override apply_batch_to_views.
+    virtual bool can_apply_to_views() const
+    {
+        return false;
+    }
+
+    // Like apply_batch, but with the input of entry i given by inputs[i].
+    virtual tensor3s_vec apply_batch_to_views(const tensor3_views&) const
+    {
+        assertion(false, "layer can not read from views");
+        return {};
+    }
+
+    // Layers taking exactly one tensor that can overwrite its values
+    // with their output of the same shape return true
+    // and override apply_batch_in_place.
+    virtual bool can_apply_in_place() const
+    {
+        return false;
+    }
+
+    // Like apply_batch, but overwrites the input tensors with the outputs,
+    // so the memory of the inputs must not be used by anything else.
+    virtual tensor3s_vec apply_batch_in_place(tensor3s_vec&&) const
+    {
+        assertion(false, "layer can not be applied in place");
+        return {};
+    }
+
+    // True for layers whose output tensors never share memory
+    // with their input tensors.
+    virtual bool returns_new_tensors() const
+    {
+        return false;
+    }
+
+    // True for layers returning the concatenation
+    // of their input tensors along the depth.
+    virtual bool concatenates_inputs() const
+    {
+        return false;
+    }
+
+    // Returns the shapes of the tensors apply would return
+    // when called with tensors of the given shapes.
+    virtual shape3s infer_output_shapes(const shape3s& input_shapes) const = 0;
+
+    // Returns the node a node_connection with the given node index refers to.
+    virtual const node& get_node(std::size_t node_idx) const
+    {
+        assertion(node_idx < nodes_.size(), "invalid node index");
+        return nodes_[node_idx];
+    }
+
+    // Estimated number of floating-point operations of one application.
+    // Defaults to one per output value.
+    virtual std::size_t estimate_flops(const shape3s&,
+        const shape3s& output_shapes) const
+    {
+        return fplus::sum(fplus::transform(
+            fplus_c_mem_fn_t(shape3, volume, std::size_t), output_shapes));
+    }
+
+    // Merges a per-channel multiply-add on the output of the layer
+    // into its weights. Returns false if the layer does not support this.
+    virtual bool fold_output_scale_shift(const float_vec&, const float_vec&)
+    {
+        return false;
     }
 
     std::string name_;
+    std::string type_;
     nodes nodes_;
 
 protected:
     virtual tensor3s apply_impl(const tensor3s& input) const = 0;
+
+    // Layers applying activation_ themselves in apply_impl,
+    // e.g. using fused_activation, return true.
+    virtual bool fuses_activation() const
+    {
+        return false;
+    }
+
+    // Applies activation_ (if any) in place to a block of output values.
+    pixel_block_transform fused_activation() const
+    {
+        const activation_layer_ptr activation = activation_;
+        return [activation](const pixel_block& block)
+        {
+            apply_activation_layer_in_place(activation, block);
+        };
+    }
+
     activation_layer_ptr activation_;
 };
 
-inline tensor3 get_layer_output(const layer_ptrs& layers,
-    output_dict& output_cache,
-    const layer_ptr& layer,
-    std::size_t node_idx, std::size_t tensor_idx)
+// The input tensors of a batch for layers taking exactly one tensor.
+inline tensor3s single_tensor_batch_inputs(const tensor3s_vec& inputs)
 {
-    return layer->get_output(layers, output_cache, node_idx, tensor_idx);
+    return fplus::transform([](const tensor3s& input) -> tensor3
+    {
+        assertion(input.size() == 1, "only one input tensor allowed");
+        return input.front();
+    }, inputs);
 }
 
-inline tensor3s apply_layer(const layer& layer, const tensor3s& inputs)
+inline tensor3_views single_tensor_batch_views(const tensor3s_vec& inputs)
 {
-    return layer.apply(inputs);
+    return tensor3_views_of(single_tensor_batch_inputs(inputs));
 }
 
-inline layer_ptr get_layer(const layer_ptrs& layers,
-    const std::string& layer_id)
+inline tensor3s_vec single_tensor_batch_outputs(const tensor3s& outputs)
 {
-    const auto is_matching_layer = [layer_id](const layer_ptr& ptr) -> bool
+    return fplus::transform([](const tensor3& output) -> tensor3s
     {
-        return ptr->name_ == layer_id;
-    };
-    return fplus::throw_on_nothing(
-        error("dangling layer reference: " + layer_id),
-        fplus::find_first_by(is_matching_layer, layers));
+        return {output};
+    }, outputs);
 }
 
 } } // namespace fdeep, namespace internal
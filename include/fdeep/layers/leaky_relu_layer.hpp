@@ -18,15 +18,25 @@ public:
         activation_layer(name), alpha_(alpha)
     {
     }
+    void transform_in_place(const pixel_block& block) const override
+    {
+        transform_pixel_block_values([this](float_type x) -> float_type
+        {
+            return activation_function(x);
+        }, block);
+    }
 protected:
     float_type alpha_;
+    float_type activation_function(float_type x) const
+    {
+        return x > 0 ? x : alpha_ * x;
+    }
     tensor3 transform_input(const tensor3& in_vol) const override
     {
-        auto activation_function = [this](float_type x) -> float_type
+        return transform_tensor3([this](float_type x) -> float_type
         {
-            return x > 0 ? x : alpha_ * x;
-        };
-        return transform_tensor3(activation_function, in_vol);
+            return activation_function(x);
+        }, in_vol);
     }
 };
 
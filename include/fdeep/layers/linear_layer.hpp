@@ -18,6 +18,14 @@ public:
         : activation_layer(name)
     {
     }
+    void transform_in_place(const pixel_block&) const override
+    {
+    }
+    // The output is the input itself.
+    bool returns_new_tensors() const override
+    {
+        return false;
+    }
 protected:
     tensor3 transform_input(const tensor3& in_vol) const override
     {
@@ -18,6 +18,15 @@ public:
         : layer(name)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(!input_shapes.empty(), "no input tensors");
+        return {input_shapes.front()};
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& input) const override
     {
@@ -8,6 +8,7 @@
 
 #include "fdeep/common.hpp"
 
+#include "fdeep/execution_plan.hpp"
 #include "fdeep/tensor3.hpp"
 
 #include "fdeep/layers/layer.hpp"
@@ -28,49 +29,115 @@ public:
             : layer(name),
             layers_(layers),
             input_connections_(input_connections),
-            output_connections_(output_connections)
+            output_connections_(output_connections),
+            plan_(compile_execution_plan(
+                layers, input_connections, output_connections))
     {
         assertion(fplus::all_unique(
             fplus::transform(fplus_get_ptr_mem(name_), layers)),
             "layer names must be unique");
     }
 
-    tensor3 get_output(const layer_ptrs& layers, output_dict& output_cache,
-        std::size_t node_idx, std::size_t tensor_idx) const override
+    const node& get_node(std::size_t node_idx) const override
     {
         // https://stackoverflow.com/questions/46011749/understanding-keras-model-architecture-node-index-of-nested-model
-        node_idx = node_idx - 1;
-        assertion(node_idx < nodes_.size(), "invalid node index");
-        return layer::get_output(layers, output_cache, node_idx, tensor_idx);
+        assertion(node_idx > 0, "invalid node index");
+        return layer::get_node(node_idx - 1);
     }
 
-protected:
-    virtual tensor3s apply_impl(const tensor3s& inputs) const override
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
     {
-        output_dict output_cache;
+        return infer_plan_output_shapes(plan_, input_shapes);
+    }
 
-        assertion(inputs.size() == input_connections_.size(),
-            "invalid number of input tensors for this model: " +
-            fplus::show(input_connections_.size()) + " required but " +
-            fplus::show(inputs.size()) + " provided");
+    // The layers of the model are profiled individually.
+    std::size_t estimate_flops(const shape3s&, const shape3s&) const override
+    {
+        return 0;
+    }
 
-        for (std::size_t i = 0; i < inputs.size(); ++i)
+    // See activation_values_lower_bound.
+    std::size_t activation_values_lower_bound(
+        const shape3s& input_shapes) const
+    {
+        return internal::activation_values_lower_bound(plan_,
+            infer_plan_slot_shapes(plan_, input_shapes));
+    }
+
+    tensor3s_vec apply_batch(const tensor3s_vec& inputs) const override
+    {
+        return apply_batch_to_input_views(
+            fplus::transform(tensor3_views_of, inputs));
+    }
+
+    // Model inputs only read by layers able to read views
+    // (e.g. convolutions) are not copied.
+    // If destinations are given, the outputs are written there
+    // instead of being returned.
+    tensor3s_vec apply_batch_to_input_views(
+        const tensor3_views_vec& inputs,
+        const output_destinations& destinations = {}) const
+    {
+        for (const auto& input : inputs)
         {
-            output_cache[input_connections_[i].without_tensor_idx()] =
-                {inputs[i]};
+            check_input_count(input.size());
         }
+        const parallelization& context = current_parallelization();
+        const auto results = context.pool_ != nullptr && context.layers_ ?
+            run_execution_plan_parallel(plan_, inputs, *context.pool_,
+                destinations) :
+            run_execution_plan(plan_, inputs, destinations);
+        if (activation_ == nullptr)
+        {
+            return results;
+        }
+        if (!destinations.empty())
+        {
+            const auto output_shapes = infer_output_shapes(fplus::transform(
+                fplus_c_mem_fn_t(tensor3_view, shape, shape3),
+                inputs.front()));
+            for (const auto& outputs : destinations)
+            {
+                for (std::size_t i = 0; i < outputs.size(); ++i)
+                {
+                    const auto& shape = output_shapes[i];
+                    const std::size_t area = shape.height_ * shape.width_;
+                    apply_activation_layer_in_place(activation_,
+                        {outputs[i], shape.depth_, area, 0, area});
+                }
+            }
+            return results;
+        }
+        return fplus::transform([this](const tensor3s& result) -> tensor3s
+        {
+            return apply_activation_layer(activation_, result);
+        }, results);
+    }
 
-        const auto get_output = [this, &output_cache]
-            (const node_connection& conn) -> tensor3
+protected:
+    virtual tensor3s apply_impl(const tensor3s& inputs) const override
+    {
+        check_input_count(inputs.size());
+        const parallelization& context = current_parallelization();
+        if (context.pool_ != nullptr && context.layers_)
         {
-            return get_layer(layers_, conn.layer_id_)->get_output(
-                layers_, output_cache, conn.node_idx_, conn.tensor_idx_);
-        };
-        return fplus::transform(get_output, output_connections_);
+            return run_execution_plan_parallel(plan_, inputs, *context.pool_);
+        }
+        return run_execution_plan(plan_, inputs);
+    }
+    void check_input_count(std::size_t count) const
+    {
+        assertion(count == input_connections_.size(),
+            "invalid number of input tensors for this model: " +
+            fplus::show(input_connections_.size()) + " required but " +
+            fplus::show(count) + " provided");
     }
     layer_ptrs layers_;
     node_connections input_connections_;
     node_connections output_connections_;
+    execution_plan plan_;
 };
 
+typedef std::shared_ptr<model_layer> model_layer_ptr;
+
 } } // namespace fdeep, namespace internal
@@ -33,6 +33,18 @@ public:
         padding_same_uses_offset_(padding_same_uses_offset)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "invalid number of input tensors");
+        const auto conv_cfg = preprocess_convolution(pool_size_, strides_,
+            padding_, use_offset(), input_shapes.front());
+        return {shape3(input_shapes.front().depth_,
+            conv_cfg.out_height_, conv_cfg.out_width_)};
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override final
     {
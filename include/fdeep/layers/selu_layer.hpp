@@ -19,18 +19,28 @@ public:
         : activation_layer(name)
     {
     }
+    void transform_in_place(const pixel_block& block) const override
+    {
+        transform_pixel_block_values([this](float_type x) -> float_type
+        {
+            return activation_function(x);
+        }, block);
+    }
 protected:
     const float_type alpha_ =
         static_cast<float_type>(1.6732632423543772848170429916717);
     const float_type scale_ =
         static_cast<float_type>(1.0507009873554804934193349852946);
+    float_type activation_function(float_type x) const
+    {
+        return scale_ * (x >= 0 ? x : alpha_ * (std::exp(x) - 1));
+    }
     tensor3 transform_input(const tensor3& in_vol) const override
     {
-        auto activation_function = [this](float_type x) -> float_type
+        return transform_tensor3([this](float_type x) -> float_type
         {
-            return scale_ * (x >= 0 ? x : alpha_ * (std::exp(x) - 1));
-        };
-        return transform_tensor3(activation_function, in_vol);
+            return activation_function(x);
+        }, in_vol);
     }
 };
 
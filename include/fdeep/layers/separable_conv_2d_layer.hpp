@@ -20,7 +20,7 @@
 namespace fdeep { namespace internal
 {
 
-// Convolve depth slices separately first.
+// Convolve depth slices separately first (depthwise_convolve).
 // Then convolve normally with kernel_size = (1, 1)
 class separable_conv_2d_layer : public layer
 {
@@ -39,7 +39,7 @@ public:
             const float_vec& bias_0,
             const float_vec& bias)
         : layer(name),
-        filters_depthwise_(fplus::transform(generate_im2col_single_filter_matrix,
+        filters_depthwise_(generate_depthwise_filter_matrix(
             generate_filters(dilation_rate, filter_shape,
                 input_depth, depthwise_weights, bias_0))),
         filters_pointwise_(generate_im2col_filter_matrix(
@@ -55,45 +55,101 @@ public:
         assertion(k > 0, "needs at least one filter");
         assertion(filter_shape.volume() > 0, "filter must have volume");
         assertion(strides.area() > 0, "invalid strides");
-        assertion(filters_depthwise_.size() == input_depth,
+        assertion(filters_depthwise_.depth_ == input_depth,
             "invalid number of filters");
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "only one input tensor allowed");
+        const auto conv_cfg = preprocess_convolution(
+            filters_depthwise_.filter_size_,
+            strides_, padding_, false, input_shapes.front());
+        return {shape3(filters_pointwise_.filter_count_,
+            conv_cfg.out_height_, conv_cfg.out_width_)};
+    }
+    std::size_t estimate_flops(const shape3s& input_shapes,
+        const shape3s& output_shapes) const override
+    {
+        const auto& out_shape = output_shapes.front();
+        const std::size_t depthwise_values =
+            out_shape.without_depth().area() * input_shapes.front().depth_;
+        return 2 * depthwise_values *
+            filters_depthwise_.filter_size_.area() +
+            2 * out_shape.volume() * input_shapes.front().depth_;
+    }
+    bool fold_output_scale_shift(const float_vec& scale,
+        const float_vec& shift) override
+    {
+        if (activation_ != nullptr || scale.size() != filters_pointwise_.filter_count_)
+        {
+            return false;
+        }
+        fold_scale_shift_into_im2col_filter_matrix(filters_pointwise_, scale, shift);
+        return true;
+    }
+    tensor3s_vec apply_batch(const tensor3s_vec& inputs) const override
+    {
+        if (inputs.empty())
+        {
+            return {};
+        }
+        return single_tensor_batch_outputs(convolve_batch(
+            single_tensor_batch_views(inputs), {}));
+    }
+    bool can_apply_to_views() const override
+    {
+        return true;
+    }
+    tensor3s_vec apply_batch_to_views(const tensor3_views& inputs)
+        const override
+    {
+        if (inputs.empty())
+        {
+            return {};
+        }
+        return single_tensor_batch_outputs(convolve_batch(inputs, {}));
+    }
+    bool can_apply_into() const override
+    {
+        return true;
+    }
+    void apply_batch_into(const tensor3s_vec& inputs,
+        const std::vector<float_type*>& destinations) const override
+    {
+        if (!inputs.empty())
+        {
+            convolve_batch(single_tensor_batch_views(inputs), destinations);
+        }
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
-        assertion(inputs.size() == 1, "only one input tensor allowed");
-
-        const auto input_slices = tensor3_to_tensor_2_depth_slices(inputs.front());
-
-        assertion(input_slices.size() == filters_depthwise_.size(),
-            "invalid input depth");
-
-        const bool use_offset = input_slices.size() == 1 ?
+        return apply_batch({inputs}).front();
+    }
+    bool fuses_activation() const override
+    {
+        return true;
+    }
+    tensor3s convolve_batch(const tensor3_views& inputs,
+        const std::vector<float_type*>& destinations) const
+    {
+        const bool use_offset = inputs.front().shape().depth_ == 1 ?
             ((padding_ == padding::valid && padding_valid_offset_depth_1_) ||
             (padding_ == padding::same && padding_same_offset_depth_1_)) :
             ((padding_ == padding::valid && padding_valid_offset_depth_2_) ||
             (padding_ == padding::same && padding_same_offset_depth_2_));
 
-        const auto convolve_slice =
-            [&](const tensor2& slice, const im2col_filter_matrix& f) -> tensor3
-        {
-            assertion(f.filter_shape_.depth_ == 1, "invalid filter depth");
-            const auto result = convolve(strides_, padding_,
-                use_offset, f, tensor2_to_tensor3(slice));
-            assertion(result.shape().depth_ == 1, "invalid conv output");
-            return result;
-        };
-
-        assertion(input_slices.size() == filters_depthwise_.size(),
-            "invalid depthwise filter count");
-        const auto temp = concatenate_tensor3s(fplus::zip_with(
-            convolve_slice, input_slices, filters_depthwise_));
-
-        return {convolve(shape2(1, 1), padding::valid, false,
-            filters_pointwise_, temp)};
+        const auto temp = depthwise_convolve(strides_, padding_, use_offset,
+            filters_depthwise_, inputs);
+        return convolve(shape2(1, 1), padding::valid, false,
+            filters_pointwise_, temp, fused_activation(), destinations);
     }
 
-    std::vector<im2col_filter_matrix> filters_depthwise_;
+    depthwise_filter_matrix filters_depthwise_;
     im2col_filter_matrix filters_pointwise_;
     shape2 strides_;
     padding padding_;
@@ -18,6 +18,10 @@ public:
         : activation_layer(name)
     {
     }
+    void transform_in_place(const pixel_block& block) const override
+    {
+        transform_pixel_block_values(activation_function, block);
+    }
 protected:
     static float_type activation_function(float_type x)
     {
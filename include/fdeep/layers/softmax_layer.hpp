@@ -6,7 +6,7 @@
 
 #pragma once
 
-#include "fdeep/layers/layer.hpp"
+#include "fdeep/layers/activation_layer.hpp"
 
 namespace fdeep { namespace internal
 {
@@ -18,40 +18,47 @@ public:
         : activation_layer(name)
     {
     }
-protected:
-    tensor3 transform_input(const tensor3& input) const override
+    void transform_in_place(const pixel_block& block) const override
     {
         // Get unnormalized values of exponent function.
-        const auto ex = [this](float_type x) -> float_type
+        transform_pixel_block_values([](float_type x) -> float_type
         {
             return std::exp(x);
-        };
-        auto output = transform_tensor3(ex, input);
+        }, block);
 
         // Softmax function is applied along channel dimension.
-        for (size_t y = 0; y < input.shape().height_; ++y)
+        const std::size_t channel_stride =
+            channels_last_layout ? 1 : block.pixel_stride_;
+        const std::size_t last_pixel = block.first_pixel_ + block.pixel_count_;
+        for (std::size_t p = block.first_pixel_; p < last_pixel; ++p)
         {
-            for (size_t x = 0; x < input.shape().width_; ++x)
+            float_type* const pixel = block.values_ +
+                (channels_last_layout ? p * block.depth_ : p);
+            // Get the sum of unnormalized values for one pixel.
+            // We are not using Kahan summation, since the number
+            // of object classes is usually quite small.
+            float_type sum = 0.0f;
+            for (std::size_t z_class = 0; z_class < block.depth_; ++z_class)
+            {
+                sum += pixel[z_class * channel_stride];
+            }
+            if (sum == 0)
+            {
+                sum = std::numeric_limits<float_type>::min();
+            }
+            // Divide the unnormalized values of each pixel by the stacks sum.
+            for (std::size_t z_class = 0; z_class < block.depth_; ++z_class)
             {
-                // Get the sum of unnormalized values for one pixel.
-                // We are not using Kahan summation, since the number
-                // of object classes is usually quite small.
-                float_type sum = 0.0f;
-                for (size_t z_class = 0; z_class < input.shape().depth_; ++z_class)
-                {
-                    sum += output.get(z_class, y, x);
-                }
-                if (sum == 0)
-                {
-                    sum = std::numeric_limits<float_type>::min();
-                }
-                // Divide the unnormalized values of each pixel by the stacks sum.
-                for (size_t z_class = 0; z_class < input.shape().depth_; ++z_class)
-                {
-                    output.set(z_class, y, x, output.get(z_class, y, x) / sum);
-                }
+                pixel[z_class * channel_stride] /= sum;
             }
         }
+    }
+protected:
+    tensor3 transform_input(const tensor3& input) const override
+    {
+        tensor3 output(storage_order_tag(), input.shape(),
+            float_vec(*input.as_vector()));
+        transform_in_place(tensor3_pixel_block(output));
         return output;
     }
 };
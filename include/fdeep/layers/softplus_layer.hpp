@@ -18,21 +18,25 @@ public:
         : activation_layer(name)
     {
     }
+    void transform_in_place(const pixel_block& block) const override
+    {
+        transform_pixel_block_values(activation_function, block);
+    }
 protected:
+    static float_type activation_function(float_type x)
+    {
+        // https://github.com/tensorflow/tensorflow/blob/626808e4e4a83aafbb3809a30db57bb78e839040/tensorflow/core/kernels/softplus_op.h#L41
+        const float_type threshold =
+            std::log(std::numeric_limits<float_type>::epsilon()) + 2;
+        if (x > -threshold) // too_large
+            return x;
+        else if (x < threshold) // too_small
+            return std::exp(x);
+        else
+            return std::log1p(std::exp(x));
+    }
     tensor3 transform_input(const tensor3& in_vol) const override
     {
-        auto activation_function = [](float_type x) -> float_type
-        {
-            // https://github.com/tensorflow/tensorflow/blob/626808e4e4a83aafbb3809a30db57bb78e839040/tensorflow/core/kernels/softplus_op.h#L41
-            const float_type threshold =
-                std::log(std::numeric_limits<float_type>::epsilon()) + 2;
-            if (x > -threshold) // too_large
-                return x;
-            else if (x < threshold) // too_small
-                return std::exp(x);
-            else
-                return std::log1p(std::exp(x));
-        };
         return transform_tensor3(activation_function, in_vol);
     }
 };
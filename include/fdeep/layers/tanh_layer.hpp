@@ -18,13 +18,17 @@ public:
         : activation_layer(name)
     {
     }
+    void transform_in_place(const pixel_block& block) const override
+    {
+        transform_pixel_block_values(activation_function, block);
+    }
 protected:
+    static float_type activation_function(float_type x)
+    {
+        return std::tanh(x);
+    }
     tensor3 transform_input(const tensor3& in_vol) const override
     {
-        const auto activation_function = [](float_type x) -> float_type
-        {
-            return std::tanh(x);
-        };
         return transform_tensor3(activation_function, in_vol);
     }
 };
@@ -26,6 +26,18 @@ public:
     scale_factor_(scale_factor)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "invalid number of inputs tensors");
+        const auto& in = input_shapes.front();
+        return {shape3(in.depth_,
+            in.height_ * scale_factor_.height_,
+            in.width_ * scale_factor_.width_)};
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override final
     {
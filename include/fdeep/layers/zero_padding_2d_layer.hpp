@@ -26,6 +26,18 @@ public:
             right_pad_(right_pad)
     {
     }
+    shape3s infer_output_shapes(const shape3s& input_shapes) const override
+    {
+        assertion(input_shapes.size() == 1, "invalid number of input tensors");
+        const auto& in = input_shapes.front();
+        return {shape3(in.depth_,
+            in.height_ + top_pad_ + bottom_pad_,
+            in.width_ + left_pad_ + right_pad_)};
+    }
+    bool returns_new_tensors() const override
+    {
+        return true;
+    }
 protected:
     tensor3s apply_impl(const tensor3s& inputs) const override
     {
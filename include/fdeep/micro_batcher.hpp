@@ -0,0 +1,184 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include "fdeep/common.hpp"
+
+#include "fdeep/tensor3.hpp"
+
+#include <fplus/fplus.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace fdeep { namespace internal
+{
+
+// Collects requests submitted concurrently from different threads
+// and runs them as micro-batches on one dispatcher thread.
+// A batch is started as soon as max_batch_size requests are waiting,
+// or when the oldest one has been waiting for max_delay.
+// Only requests with the same input shapes are batched together.
+class micro_batcher
+{
+public:
+    typedef std::function<std::vector<tensor3s>(
+        const std::vector<tensor3s>&)> batch_function;
+
+    micro_batcher(const batch_function& run_batch,
+        std::size_t max_batch_size,
+        const std::chrono::microseconds& max_delay) :
+            run_batch_(run_batch),
+            max_batch_size_(max_batch_size),
+            max_delay_(max_delay),
+            mutex_(),
+            cond_(),
+            requests_(),
+            stop_(false),
+            dispatcher_()
+    {
+        assertion(max_batch_size_ > 0, "invalid maximum batch size");
+        dispatcher_ = std::thread([this]() { dispatch(); });
+    }
+    // Requests still waiting are run before the dispatcher stops.
+    ~micro_batcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        dispatcher_.join();
+    }
+    micro_batcher(const micro_batcher&) = delete;
+    micro_batcher& operator=(const micro_batcher&) = delete;
+
+    std::future<tensor3s> submit(const tensor3s& inputs)
+    {
+        request req(inputs);
+        auto result = req.promise_.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            requests_.push_back(std::move(req));
+        }
+        cond_.notify_all();
+        return result;
+    }
+
+private:
+    struct request
+    {
+        explicit request(const tensor3s& inputs) :
+            inputs_(inputs),
+            promise_(),
+            arrival_(std::chrono::steady_clock::now())
+        {
+        }
+        tensor3s inputs_;
+        std::promise<tensor3s> promise_;
+        std::chrono::steady_clock::time_point arrival_;
+    };
+
+    static shape3s input_shapes(const request& req)
+    {
+        return fplus::transform(fplus_c_mem_fn_t(tensor3, shape, shape3),
+            req.inputs_);
+    }
+
+    // Removes the oldest request and up to max_batch_size_ - 1
+    // further ones with the same input shapes from the queue.
+    std::vector<request> take_batch()
+    {
+        const auto shapes = input_shapes(requests_.front());
+        std::vector<request> batch;
+        std::deque<request> remaining;
+        for (auto& req : requests_)
+        {
+            if (batch.size() < max_batch_size_ && input_shapes(req) == shapes)
+            {
+                batch.push_back(std::move(req));
+            }
+            else
+            {
+                remaining.push_back(std::move(req));
+            }
+        }
+        std::swap(requests_, remaining);
+        return batch;
+    }
+
+    void run(std::vector<request>& batch) const
+    {
+        std::vector<tensor3s> results;
+        try
+        {
+            results = run_batch_(fplus::transform(
+                [](const request& req) -> tensor3s
+            {
+                return req.inputs_;
+            }, batch));
+            assertion(results.size() == batch.size(), "invalid batch result");
+        }
+        catch (...)
+        {
+            for (auto& req : batch)
+            {
+                req.promise_.set_exception(std::current_exception());
+            }
+            return;
+        }
+        for (std::size_t i = 0; i < batch.size(); ++i)
+        {
+            batch[i].promise_.set_value(results[i]);
+        }
+    }
+
+    void dispatch()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            cond_.wait(lock, [this]() -> bool
+            {
+                return stop_ || !requests_.empty();
+            });
+            if (requests_.empty())
+            {
+                return;
+            }
+            cond_.wait_until(lock, requests_.front().arrival_ + max_delay_,
+                [this]() -> bool
+            {
+                return stop_ || requests_.size() >= max_batch_size_;
+            });
+            auto batch = take_batch();
+            lock.unlock();
+            run(batch);
+            lock.lock();
+        }
+    }
+
+    batch_function run_batch_;
+    std::size_t max_batch_size_;
+    std::chrono::microseconds max_delay_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<request> requests_;
+    bool stop_;
+    std::thread dispatcher_;
+};
+
+} } // namespace fdeep, namespace internal
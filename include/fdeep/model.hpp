@@ -8,6 +8,15 @@
 
 #include "fdeep/common.hpp"
 #include "fdeep/import_model.hpp"
+#include "fdeep/micro_batcher.hpp"
+#include "fdeep/profiling.hpp"
+#include "fdeep/thread_pool.hpp"
+#include "fdeep/tracing.hpp"
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
 
 namespace fdeep
 {
@@ -18,16 +27,80 @@ public:
     // A single forward pass.
     tensor3s predict(const tensor3s& inputs) const
     {
-        const auto outputs = model_layer_->apply(inputs);
+        return predict(internal::tensor3_views_of(inputs));
+    }
+
+    // A single forward pass with inputs referring to memory owned by the
+    // caller (see tensor3_view), which has to stay valid until predict
+    // returns. Inputs only read by layers able to read views directly
+    // (e.g. convolutions) are not copied.
+    tensor3s predict(const tensor3_views& inputs) const
+    {
+        return predict_on(thread_pool_.get(), inputs);
+    }
+
+    // A single forward pass writing output i directly into outputs[i],
+    // which must have room for get_output_shapes()[i].volume() values.
+    // They are stored in the same order as in tensor3::as_vector().
+    // Only the input shapes are checked, the output shapes follow
+    // from them (checked when loading the model).
+    void predict_into(const tensor3_views& inputs,
+        const std::vector<float_type*>& outputs) const
+    {
         internal::assertion(
-            fplus::transform(fplus_c_mem_fn_t(tensor3, shape, shape3), outputs)
-            == get_output_shapes(), "invalid outputs shape");
-        return outputs;
+            fplus::transform(fplus_c_mem_fn_t(tensor3_view, shape, shape3),
+                inputs) == get_input_shapes(), "invalid inputs shape");
+        internal::assertion(outputs.size() == get_output_shapes().size(),
+            "invalid number of outputs");
+        const internal::parallelization_scope parallelization_scope(
+            {thread_pool_.get(), parallel_layers_, parallel_ops_});
+        const internal::profiler_scope profiler_scope(profiler_.get());
+        const internal::tracer_scope tracer_scope(tracer_.get());
+        const internal::trace_span span("predict_into", "model");
+        model_layer_->apply_batch_to_input_views(
+            internal::tensor3_views_vec(1, inputs),
+            internal::output_destinations(1, outputs));
+    }
+
+    void predict_into(const tensor3s& inputs,
+        const std::vector<float_type*>& outputs) const
+    {
+        predict_into(internal::tensor3_views_of(inputs), outputs);
+    }
+
+    // Forward pass of multiple data as one batch,
+    // i.e. every layer processes all of them at once.
+    // The shapes of all entries of the batch must be the same.
+    std::vector<tensor3s> predict_batch(
+        const std::vector<tensor3s>& inputs_vec) const
+    {
+        return predict_batch(fplus::transform(internal::tensor3_views_of,
+            inputs_vec));
+    }
+
+    std::vector<tensor3s> predict_batch(
+        const std::vector<tensor3_views>& inputs_vec) const
+    {
+        const internal::parallelization_scope parallelization_scope(
+            {thread_pool_.get(), parallel_layers_, parallel_ops_});
+        const internal::profiler_scope profiler_scope(profiler_.get());
+        const internal::tracer_scope tracer_scope(tracer_.get());
+        const internal::trace_span span("predict_batch", "model");
+        const auto outputs_vec =
+            model_layer_->apply_batch_to_input_views(inputs_vec);
+        for (const auto& outputs : outputs_vec)
+        {
+            internal::assertion(
+                fplus::transform(fplus_c_mem_fn_t(tensor3, shape, shape3),
+                    outputs) == get_output_shapes(), "invalid outputs shape");
+        }
+        return outputs_vec;
     }
 
     // Forward pass multiple data.
-    // When parallelly == true, the work is distributed to up to
-    // as many CPUs as data entries are provided.
+    // When parallelly == true, the work is distributed over the threads
+    // of the model's pool (see set_parallelism) or, if it has none,
+    // the process-wide one (see set_default_thread_count).
     std::vector<tensor3s> predict_multi(const std::vector<tensor3s>& inputs_vec,
         bool parallelly) const
     {
@@ -35,14 +108,57 @@ public:
         {
             return predict(inputs);
         };
-        if (parallelly)
+        if (!parallelly)
         {
-            return fplus::transform_parallelly(f, inputs_vec);
+            return fplus::transform(f, inputs_vec);
         }
-        else
+        const auto pool = thread_pool_ != nullptr ?
+            thread_pool_ : internal::default_thread_pool();
+        std::vector<tensor3s> results(inputs_vec.size());
+        internal::task_group tasks(*pool);
+        for (std::size_t i = 0; i < inputs_vec.size(); ++i)
         {
-            return fplus::transform(f, inputs_vec);
+            tasks.run([&f, &inputs_vec, &results, i]()
+            {
+                results[i] = f(inputs_vec[i]);
+            });
+        }
+        tasks.wait();
+        return results;
+    }
+
+    // Forward pass in the background, on the model's pool
+    // (see set_parallelism) or, if it has none, the process-wide one.
+    // With micro-batching enabled (see set_micro_batching), requests
+    // arriving concurrently are run together using predict_batch.
+    std::future<tensor3s> predict_async(const tensor3s& inputs) const
+    {
+        if (micro_batcher_ != nullptr)
+        {
+            return micro_batcher_->submit(inputs);
         }
+        const auto pool = thread_pool_ != nullptr ?
+            thread_pool_ : internal::default_thread_pool();
+        // The task must not own the pool it runs on,
+        // since it could not be destroyed from one of its own threads.
+        // Destroying the pool runs the queued tasks first.
+        model self = *this;
+        self.thread_pool_ = nullptr;
+        internal::thread_pool* const own_pool = thread_pool_.get();
+        const auto promise = std::make_shared<std::promise<tensor3s>>();
+        pool->post([self, own_pool, inputs, promise]()
+        {
+            try
+            {
+                promise->set_value(self.predict_on(own_pool,
+                    internal::tensor3_views_of(inputs)));
+            }
+            catch (...)
+            {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        return promise->get_future();
     }
 
     // Convenience wrapper around predict for models with
@@ -78,7 +194,97 @@ public:
         }, get_input_shapes());
     }
 
+    // A forward pass releases every tensor after its last use.
+    // This is the number of bytes needed at the same time for the tensors
+    // still in use, computed at load time. It is a lower bound only,
+    // not a limit enforced at runtime: the tensors are allocated one by one,
+    // so allocator overhead and tensors inside nested models come on top.
+    std::size_t get_activation_memory_lower_bound() const
+    {
+        return activation_memory_lower_bound_;
+    }
+
+    // Opt-in: Give the model its own pool of thread_count threads
+    // (besides the calling one) to reduce the latency of single
+    // forward passes. It is also used by predict_multi.
+    // parallel_layers: Compute independent branches of the computational
+    // graph (e.g. the towers of an Inception module) concurrently.
+    // parallel_ops: Split the im2col/GEMM work of convolutions and
+    // the GEMMs of dense layers into blocks of output values.
+    // Split reductions can round differently, so the results may differ
+    // from single-threaded ones in the last bits.
+    // 0 (default) means single-threaded.
+    // Must not be called while the model is predicting.
+    void set_parallelism(std::size_t thread_count,
+        bool parallel_layers = true, bool parallel_ops = true)
+    {
+        thread_pool_ = thread_count == 0 ? nullptr :
+            std::make_shared<internal::thread_pool>(thread_count);
+        parallel_layers_ = parallel_layers;
+        parallel_ops_ = parallel_ops;
+        restart_micro_batching();
+    }
+
+    // Opt-in: Let predict_async collect concurrent requests into batches
+    // of up to max_batch_size entries, waiting at most max_delay for
+    // further requests after the first one has arrived.
+    // This trades a bounded amount of latency for more throughput.
+    // Later changes of the parallelism, profiling or tracing
+    // also apply to the batches.
+    // max_batch_size 0 disables it again.
+    // Must not be called while the model is predicting.
+    void set_micro_batching(std::size_t max_batch_size,
+        const std::chrono::microseconds& max_delay =
+            std::chrono::microseconds(1000))
+    {
+        micro_batch_size_ = max_batch_size;
+        micro_batch_delay_ = max_delay;
+        restart_micro_batching();
+    }
+
+    // Opt-in: Record the costs of every layer during all following
+    // forward passes, see get_profile. Off (the default) it costs nothing.
+    // Turning it on again starts a new profile.
+    // Must not be called while the model is predicting.
+    void set_profiling(bool enabled)
+    {
+        profiler_ = enabled ? std::make_shared<internal::profiler>() : nullptr;
+        restart_micro_batching();
+    }
+
+    // Per-layer wall time, call count, output shapes, bytes allocated
+    // for the outputs and estimated FLOPs, summed over all forward passes
+    // since set_profiling(true). The most expensive layers come first.
+    // Layers of nested models are listed in addition to the model itself.
+    layer_profiles get_profile() const
+    {
+        internal::assertion(profiler_ != nullptr, "profiling is not enabled");
+        return profiler_->report();
+    }
+
+    // Opt-in: Record a timeline of all following forward passes,
+    // see get_trace_json. Off (the default) it costs nothing.
+    // Turning it on again starts a new timeline.
+    // Must not be called while the model is predicting.
+    void set_tracing(bool enabled)
+    {
+        tracer_ = enabled ? std::make_shared<internal::tracer>() : nullptr;
+        restart_micro_batching();
+    }
+
+    // The timeline since set_tracing(true) in Chrome Trace Event JSON,
+    // to be loaded into chrome://tracing or the Perfetto UI.
+    // It has one span per predict call and layer, and for convolutions
+    // sub-spans for allocation, padding, im2col and GEMM, on the threads
+    // they ran on.
+    std::string get_trace_json() const
+    {
+        internal::assertion(tracer_ != nullptr, "tracing is not enabled");
+        return tracer_->to_json();
+    }
+
     // Measure time of one single forward pass using dummy input data.
+    // See set_profiling for the costs of the individual layers.
     double test_speed() const
     {
         const auto inputs = generate_dummy_inputs();
@@ -88,21 +294,108 @@ public:
     }
 
 private:
-    model(const internal::layer_ptr& model_layer,
+    model(const internal::model_layer_ptr& model_layer,
         const std::vector<shape3>& input_shapes,
         const std::vector<shape3>& output_shapes) :
             input_shapes_(input_shapes),
             output_shapes_(output_shapes),
-            model_layer_(model_layer) {}
+            model_layer_(model_layer),
+            activation_memory_lower_bound_(sizeof(float_type) *
+                model_layer->activation_values_lower_bound(input_shapes)),
+            thread_pool_(nullptr),
+            parallel_layers_(false),
+            parallel_ops_(false),
+            micro_batch_size_(0),
+            micro_batch_delay_(0),
+            micro_batcher_(nullptr),
+            profiler_(nullptr),
+            tracer_(nullptr)
+    {
+        internal::assertion(
+            model_layer_->infer_output_shapes(input_shapes_) == output_shapes_,
+            "output shapes of model do not match its architecture");
+    }
+
+    // A single forward pass distributing its work over pool (if any).
+    tensor3s predict_on(internal::thread_pool* pool,
+        const tensor3_views& inputs) const
+    {
+        const internal::parallelization_scope parallelization_scope(
+            {pool, parallel_layers_, parallel_ops_});
+        const internal::profiler_scope profiler_scope(profiler_.get());
+        const internal::tracer_scope tracer_scope(tracer_.get());
+        const internal::trace_span span("predict", "model");
+        const auto outputs = model_layer_->apply_batch_to_input_views(
+            internal::tensor3_views_vec(1, inputs)).front();
+        internal::assertion(
+            fplus::transform(fplus_c_mem_fn_t(tensor3, shape, shape3), outputs)
+            == get_output_shapes(), "invalid outputs shape");
+        return outputs;
+    }
+
+    // Replaces the micro_batcher (if enabled) by one running its batches
+    // with the current settings. Requests already waiting are run first.
+    void restart_micro_batching()
+    {
+        micro_batcher_ = nullptr;
+        if (micro_batch_size_ == 0)
+        {
+            return;
+        }
+        const model self = *this;
+        micro_batcher_ = std::make_shared<internal::micro_batcher>(
+            [self](const std::vector<tensor3s>& inputs_vec)
+                -> std::vector<tensor3s>
+            {
+                return self.predict_batch(inputs_vec);
+            }, micro_batch_size_, micro_batch_delay_);
+    }
 
     friend model read_model(const std::string&, bool,
         const std::function<void(std::string)>&, float_type);
 
     std::vector<shape3> input_shapes_;
     std::vector<shape3> output_shapes_;
-    internal::layer_ptr model_layer_;
+    internal::model_layer_ptr model_layer_;
+    std::size_t activation_memory_lower_bound_;
+    std::shared_ptr<internal::thread_pool> thread_pool_;
+    bool parallel_layers_;
+    bool parallel_ops_;
+    std::size_t micro_batch_size_;
+    std::chrono::microseconds micro_batch_delay_;
+    std::shared_ptr<internal::micro_batcher> micro_batcher_;
+    std::shared_ptr<internal::profiler> profiler_;
+    std::shared_ptr<internal::tracer> tracer_;
 };
 
+// Sets the number of threads of the process-wide pool used by
+// predict_multi for models without their own pool. Defaults to the
+// number of hardware threads minus one (the calling thread also works).
+// Predictions already running finish on the previous pool.
+inline void set_default_thread_count(std::size_t thread_count)
+{
+    internal::assertion(thread_count > 0, "invalid thread count");
+    auto pool = std::make_shared<internal::thread_pool>(thread_count);
+    std::lock_guard<std::mutex> lock(internal::default_thread_pool_mutex());
+    std::swap(internal::default_thread_pool_instance(), pool);
+}
+
+// Hits, misses and retained memory of the process-wide pool
+// the values of all tensors are allocated from. With the pool enabled,
+// a forward pass repeating the allocations of a previous one only has hits.
+inline buffer_pool_stats get_buffer_pool_stats()
+{
+    return internal::global_buffer_pool().stats();
+}
+
+// Opt-in: Sets how much freed memory (in bytes) the pool may keep
+// for reuse. Defaults to zero, i.e. the pool is disabled
+// and all memory is freed right away.
+inline void set_buffer_pool_limit(std::size_t max_retained_bytes)
+{
+    internal::global_buffer_pool().set_max_retained_bytes(max_retained_bytes);
+}
+
 // Write an std::string to std::cout.
 inline void cout_logger(const std::string& str)
 {
@@ -0,0 +1,137 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include "fdeep/common.hpp"
+
+#include "fdeep/shape3.hpp"
+
+#include <fplus/fplus.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fdeep { namespace internal
+{
+
+// Accumulated costs of one layer over all profiled forward passes.
+// output_bytes_: Memory allocated for the output tensors, nothing for
+// layers writing into existing memory (their input, the output
+// of a concatenation or memory given by the caller).
+// flops_: Estimated number of floating-point operations.
+struct layer_profile
+{
+    std::string name_;
+    std::string type_;
+    std::size_t calls_;
+    double seconds_;
+    shape3s output_shapes_;
+    std::size_t output_bytes_;
+    std::size_t flops_;
+};
+typedef std::vector<layer_profile> layer_profiles;
+
+// Collects the layer_profiles of the forward passes
+// running on any thread while it is the current_profiler.
+class profiler
+{
+public:
+    profiler() : mutex_(), profiles_(), indices_()
+    {
+    }
+
+    // One application of a layer to a batch of batch_size entries.
+    void record(const std::string& name, const std::string& type,
+        double seconds, const shape3s& output_shapes,
+        bool allocates_outputs, std::size_t batch_size, std::size_t flops)
+    {
+        const std::size_t output_bytes = !allocates_outputs ? 0 :
+            batch_size * sizeof(float_type) * fplus::sum(fplus::transform(
+                fplus_c_mem_fn_t(shape3, volume, std::size_t), output_shapes));
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto it = indices_.find(name);
+        if (it == indices_.end())
+        {
+            indices_[name] = profiles_.size();
+            profiles_.push_back({name, type, 1, seconds,
+                output_shapes, output_bytes, batch_size * flops});
+            return;
+        }
+        auto& profile = profiles_[it->second];
+        ++profile.calls_;
+        profile.seconds_ += seconds;
+        profile.output_shapes_ = output_shapes;
+        profile.output_bytes_ += output_bytes;
+        profile.flops_ += batch_size * flops;
+    }
+
+    // The most expensive layers (by wall time) come first.
+    layer_profiles report() const
+    {
+        layer_profiles result;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            result = profiles_;
+        }
+        std::stable_sort(std::begin(result), std::end(result),
+            [](const layer_profile& a, const layer_profile& b) -> bool
+        {
+            return a.seconds_ > b.seconds_;
+        });
+        return result;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        profiles_.clear();
+        indices_.clear();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    layer_profiles profiles_;
+    std::map<std::string, std::size_t> indices_;
+};
+
+// Forward passes are only instrumented if this is set,
+// otherwise checking it is all profiling costs.
+inline profiler*& current_profiler()
+{
+    static thread_local profiler* current = nullptr;
+    return current;
+}
+
+// Sets current_profiler for the lifetime of the scope.
+class profiler_scope
+{
+public:
+    explicit profiler_scope(profiler* p) :
+        previous_(current_profiler())
+    {
+        current_profiler() = p;
+    }
+    ~profiler_scope()
+    {
+        current_profiler() = previous_;
+    }
+    profiler_scope(const profiler_scope&) = delete;
+    profiler_scope& operator=(const profiler_scope&) = delete;
+private:
+    profiler* previous_;
+};
+
+} // namespace internal
+
+using layer_profile = internal::layer_profile;
+using layer_profiles = internal::layer_profiles;
+
+} // namespace fdeep
@@ -13,6 +13,7 @@
 #include <cstddef>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 namespace fdeep { namespace internal
 {
@@ -44,6 +45,8 @@ public:
     std::size_t width_;
 };
 
+typedef std::vector<shape3> shape3s;
+
 inline bool operator == (const shape3& lhs, const shape3& rhs)
 {
     return
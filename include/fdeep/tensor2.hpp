@@ -94,7 +94,8 @@ tensor2 transform_tensor2(F f, const tensor2& m)
 
 inline tensor2 add_to_tensor2_elems(const tensor2& m, float_type x)
 {
-    return tensor2(m.shape(), fplus::transform([x](float_type e) -> float_type
+    return tensor2(m.shape(), fplus::transform_convert<float_vec>(
+        [x](float_type e) -> float_type
     {
         return x + e;
     }, *m.as_vector()));
@@ -102,7 +103,8 @@ inline tensor2 add_to_tensor2_elems(const tensor2& m, float_type x)
 
 inline tensor2 sub_from_tensor2_elems(const tensor2& m, float_type x)
 {
-    return tensor2(m.shape(), fplus::transform([x](float_type e) -> float_type
+    return tensor2(m.shape(), fplus::transform_convert<float_vec>(
+        [x](float_type e) -> float_type
     {
         return e - x;
     }, *m.as_vector()));
@@ -110,7 +112,8 @@ inline tensor2 sub_from_tensor2_elems(const tensor2& m, float_type x)
 
 inline tensor2 multiply_tensor2_elems(const tensor2& m, float_type x)
 {
-    return tensor2(m.shape(), fplus::transform([x](float_type e) -> float_type
+    return tensor2(m.shape(), fplus::transform_convert<float_vec>(
+        [x](float_type e) -> float_type
     {
         return x * e;
     }, *m.as_vector()));
@@ -118,7 +121,8 @@ inline tensor2 multiply_tensor2_elems(const tensor2& m, float_type x)
 
 inline tensor2 divide_tensor2_elems(const tensor2& m, float_type x)
 {
-    return tensor2(m.shape(), fplus::transform([x](float_type e) -> float_type
+    return tensor2(m.shape(), fplus::transform_convert<float_vec>(
+        [x](float_type e) -> float_type
     {
         return e / x;
     }, *m.as_vector()));
@@ -14,6 +14,7 @@
 
 #include <fplus/fplus.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <functional>
@@ -23,22 +24,78 @@
 namespace fdeep { namespace internal
 {
 
+// Tag of the tensor3 constructors taking values in storage order
+// (see channels_last_layout) as they are. Only used internally.
+struct storage_order_tag
+{
+};
+
+// Values given depth-first (depth, height, width) in storage order.
+inline float_vec depth_first_to_storage_order(const shape3& shape,
+    float_vec&& values)
+{
+    assertion(shape.volume() == values.size(), "invalid number of values");
+    if (!channels_last_layout)
+    {
+        return std::move(values);
+    }
+    float_vec result(values.size());
+    std::size_t i = 0;
+    for (std::size_t z = 0; z < shape.depth_; ++z)
+    {
+        for (std::size_t y = 0; y < shape.height_; ++y)
+        {
+            for (std::size_t x = 0; x < shape.width_; ++x)
+            {
+                result[(y * shape.width_ + x) * shape.depth_ + z] =
+                    values[i++];
+            }
+        }
+    }
+    return result;
+}
+
+// The public constructors take the values depth-first, independent of
+// the storage order, which as_vector() refers to.
 class tensor3
 {
 public:
-    tensor3(const shape3& shape, const shared_float_vec& values) :
+    tensor3(storage_order_tag, const shape3& shape,
+        const shared_float_vec& values) :
         shape_(shape),
         values_(values)
     {
         assertion(shape.volume() == values->size(), "invalid number of values");
     }
-    tensor3(const shape3& shape, float_vec&& values) :
+    tensor3(storage_order_tag, const shape3& shape, float_vec&& values) :
         shape_(shape),
         values_(fplus::make_shared_ref<float_vec>(std::move(values)))
     {
         assertion(shape.volume() == values_->size(),
             "invalid number of values");
     }
+    tensor3(const shape3& shape, const shared_float_vec& values) :
+        tensor3(storage_order_tag(), shape, channels_last_layout ?
+            fplus::make_shared_ref<float_vec>(depth_first_to_storage_order(
+                shape, float_vec(*values))) :
+            values)
+    {
+    }
+    tensor3(const shape3& shape, float_vec&& values) :
+        tensor3(storage_order_tag(), shape,
+            depth_first_to_storage_order(shape, std::move(values)))
+    {
+    }
+    // Copies values given in a vector with another allocator,
+    // e.g. a plain std::vector<float_type> as before float_vec was aligned.
+    // Being a template, it is no candidate for braced lists of values,
+    // which keep going to the float_vec constructor.
+    template <typename Alloc>
+    tensor3(const shape3& shape,
+        const std::vector<float_type, Alloc>& values) :
+        tensor3(shape, float_vec(values.begin(), values.end()))
+    {
+    }
     tensor3(const shape3& shape, float_type value) :
         shape_(shape),
         values_(fplus::make_shared_ref<float_vec>(shape.volume(), value))
@@ -87,10 +144,21 @@ public:
     {
         return values_;
     }
+    shared_float_vec& as_vector()
+    {
+        return values_;
+    }
 
 private:
     std::size_t idx(const tensor3_pos& pos) const
     {
+        if (channels_last_layout)
+        {
+            return
+                pos.y_ * shape().width_ * shape().depth_ +
+                pos.x_ * shape().depth_ +
+                pos.z_;
+        }
         return
             pos.z_ * shape().height_ * shape().width_ +
             pos.y_ * shape().width_ +
@@ -101,11 +169,345 @@ private:
 };
 
 typedef std::vector<tensor3> tensor3s;
+typedef std::vector<tensor3s> tensor3s_vec;
+
+// Strided view into the values of a tensor3, e.g. a cropped region
+// or a single depth slice, without copying them.
+// Value (z, y, x) is stored at
+// data() + z * z_stride_ + y * y_stride_ + x * x_stride_.
+// A view can also refer to memory owned by the caller, e.g. an input
+// frame, which then has to stay valid as long as the view is used.
+class tensor3_view
+{
+public:
+    explicit tensor3_view(const tensor3& t) :
+        values_(fplus::just(t.as_vector())),
+        data_(t.as_vector()->data()),
+        shape_(t.shape()),
+        z_stride_(dense_z_stride(t.shape())),
+        y_stride_(dense_y_stride(t.shape())),
+        x_stride_(dense_x_stride(t.shape()))
+    {
+    }
+    tensor3_view(const shared_float_vec& values, std::size_t offset,
+        const shape3& shape,
+        std::size_t z_stride, std::size_t y_stride, std::size_t x_stride) :
+        values_(fplus::just(values)),
+        data_(values->data() + offset),
+        shape_(shape),
+        z_stride_(z_stride),
+        y_stride_(y_stride),
+        x_stride_(x_stride)
+    {
+    }
+    // Values in the storage order of tensor3, not owned by the view.
+    tensor3_view(const float_type* data, const shape3& shape) :
+        values_(),
+        data_(data),
+        shape_(shape),
+        z_stride_(dense_z_stride(shape)),
+        y_stride_(dense_y_stride(shape)),
+        x_stride_(dense_x_stride(shape))
+    {
+    }
+    tensor3_view(const float_type* data, const shape3& shape,
+        std::size_t z_stride, std::size_t y_stride, std::size_t x_stride) :
+        values_(),
+        data_(data),
+        shape_(shape),
+        z_stride_(z_stride),
+        y_stride_(y_stride),
+        x_stride_(x_stride)
+    {
+    }
+    tensor3_view(const tensor3_view&) = default;
+    tensor3_view(tensor3_view&&) = default;
+    tensor3_view& operator=(const tensor3_view&) = default;
+    tensor3_view& operator=(tensor3_view&&) = default;
+    float_type get(std::size_t z, std::size_t y, std::size_t x) const
+    {
+        return data_[z * z_stride_ + y * y_stride_ + x * x_stride_];
+    }
+    float_type get_x_y_padded(float_type pad_value,
+        std::size_t z, int y, int x) const
+    {
+        if (y < 0 || y >= static_cast<int>(shape_.height_) ||
+            x < 0 || x >= static_cast<int>(shape_.width_))
+        {
+            return pad_value;
+        }
+        return get(z, static_cast<std::size_t>(y), static_cast<std::size_t>(x));
+    }
+    // Position of value (0, 0, 0).
+    const float_type* data() const
+    {
+        return data_;
+    }
+    // False if the values are owned by the caller.
+    bool refers_to_tensor() const
+    {
+        return fplus::is_just(values_);
+    }
+    // The tensor values the view refers to.
+    const shared_float_vec& values() const
+    {
+        assertion(refers_to_tensor(), "view does not refer to a tensor");
+        return values_.unsafe_get_just();
+    }
+    const shape3& shape() const
+    {
+        return shape_;
+    }
+    std::size_t z_stride() const
+    {
+        return z_stride_;
+    }
+    std::size_t y_stride() const
+    {
+        return y_stride_;
+    }
+    std::size_t x_stride() const
+    {
+        return x_stride_;
+    }
+    // Same values (and owner) as this view, starting at another position.
+    tensor3_view sub_view(std::size_t offset, const shape3& shape) const
+    {
+        tensor3_view result(*this);
+        result.data_ += offset;
+        result.shape_ = shape;
+        return result;
+    }
+    // True if the values are stored like in a tensor3 of the same shape.
+    bool has_dense_strides() const
+    {
+        return z_stride_ == dense_z_stride(shape_) &&
+            y_stride_ == dense_y_stride(shape_) &&
+            x_stride_ == dense_x_stride(shape_);
+    }
+    // True if the view covers a whole tensor3 with the same shape.
+    bool is_dense() const
+    {
+        return refers_to_tensor() && data_ == values()->data() &&
+            values()->size() == shape_.volume() && has_dense_strides();
+    }
+
+private:
+    static std::size_t dense_z_stride(const shape3& shape)
+    {
+        return channels_last_layout ? 1 : shape.height_ * shape.width_;
+    }
+    static std::size_t dense_y_stride(const shape3& shape)
+    {
+        return channels_last_layout ? shape.width_ * shape.depth_ : shape.width_;
+    }
+    static std::size_t dense_x_stride(const shape3& shape)
+    {
+        return channels_last_layout ? shape.depth_ : 1;
+    }
+
+    fplus::maybe<shared_float_vec> values_;
+    const float_type* data_;
+    shape3 shape_;
+    std::size_t z_stride_;
+    std::size_t y_stride_;
+    std::size_t x_stride_;
+};
+
+typedef std::vector<tensor3_view> tensor3_views;
+typedef std::vector<tensor3_views> tensor3_views_vec;
+
+inline tensor3_views tensor3_views_of(const tensor3s& ts)
+{
+    return fplus::transform_convert<tensor3_views>(
+        [](const tensor3& t) -> tensor3_view
+    {
+        return tensor3_view(t);
+    }, ts);
+}
+
+inline tensor3_view crop_tensor3_view(
+    std::size_t top_crop, std::size_t bottom_crop,
+    std::size_t left_crop, std::size_t right_crop,
+    const tensor3_view& in)
+{
+    assertion(top_crop + bottom_crop <= in.shape().height_ &&
+        left_crop + right_crop <= in.shape().width_, "invalid crop");
+    return in.sub_view(top_crop * in.y_stride() + left_crop * in.x_stride(),
+        shape3(in.shape().depth_,
+            in.shape().height_ - (top_crop + bottom_crop),
+            in.shape().width_ - (left_crop + right_crop)));
+}
+
+inline tensor3_view depth_slice_view(std::size_t z, const tensor3_view& in)
+{
+    assertion(z < in.shape().depth_, "invalid depth slice");
+    return in.sub_view(z * in.z_stride(),
+        shape3(1, in.shape().height_, in.shape().width_));
+}
+
+// Copies the values of a view into a new tensor3,
+// unless they already form one.
+inline tensor3 tensor3_from_view(const tensor3_view& view)
+{
+    if (view.is_dense())
+    {
+        return tensor3(storage_order_tag(), view.shape(), view.values());
+    }
+    const auto& shape = view.shape();
+    if (view.has_dense_strides())
+    {
+        return tensor3(storage_order_tag(), shape,
+            float_vec(view.data(), view.data() + shape.volume()));
+    }
+    float_vec values;
+    values.reserve(shape.volume());
+    if (channels_last_layout)
+    {
+        for (std::size_t y = 0; y < shape.height_; ++y)
+        {
+            for (std::size_t x = 0; x < shape.width_; ++x)
+            {
+                const float_type* const pixel =
+                    view.data() + y * view.y_stride() + x * view.x_stride();
+                for (std::size_t z = 0; z < shape.depth_; ++z)
+                {
+                    values.push_back(pixel[z * view.z_stride()]);
+                }
+            }
+        }
+    }
+    else
+    {
+        for (std::size_t z = 0; z < shape.depth_; ++z)
+        {
+            for (std::size_t y = 0; y < shape.height_; ++y)
+            {
+                const float_type* const row =
+                    view.data() + z * view.z_stride() + y * view.y_stride();
+                for (std::size_t x = 0; x < shape.width_; ++x)
+                {
+                    values.push_back(row[x * view.x_stride()]);
+                }
+            }
+        }
+    }
+    return tensor3(storage_order_tag(), shape, std::move(values));
+}
+
+// The values of a tensor3 in depth-first order,
+// independent of the storage order.
+inline float_vec depth_first_values(const tensor3& t)
+{
+    if (!channels_last_layout)
+    {
+        return *t.as_vector();
+    }
+    float_vec values;
+    values.reserve(t.shape().volume());
+    for (std::size_t z = 0; z < t.shape().depth_; ++z)
+    {
+        for (std::size_t y = 0; y < t.shape().height_; ++y)
+        {
+            for (std::size_t x = 0; x < t.shape().width_; ++x)
+            {
+                values.push_back(t.get(z, y, x));
+            }
+        }
+    }
+    return values;
+}
+
+// Creates a tensor3 from values given in depth-first order,
+// e.g. the ones stored in model files.
+inline tensor3 tensor3_from_depth_first_values(const shape3& shape,
+    float_vec&& values)
+{
+    return tensor3(shape, std::move(values));
+}
 
 template <typename F>
 tensor3 transform_tensor3(F f, const tensor3& m)
 {
-    return tensor3(m.shape(), fplus::transform(f, *m.as_vector()));
+    return tensor3(storage_order_tag(), m.shape(),
+        fplus::transform_convert<float_vec>(f, *m.as_vector()));
+}
+
+// The pixels [first_pixel_, first_pixel_ + pixel_count_) of all channels
+// of a buffer holding pixel_stride_ pixels (in tensor3 storage order).
+// Allows layers to post-process parts of their output in place,
+// while these are still in cache.
+struct pixel_block
+{
+    float_type* values_;
+    std::size_t depth_;
+    std::size_t pixel_stride_;
+    std::size_t first_pixel_;
+    std::size_t pixel_count_;
+};
+
+typedef std::function<void(const pixel_block&)> pixel_block_transform;
+
+template <typename F>
+void transform_pixel_block_values(F f, const pixel_block& block)
+{
+    if (channels_last_layout)
+    {
+        float_type* const first =
+            block.values_ + block.first_pixel_ * block.depth_;
+        std::transform(first, first + block.pixel_count_ * block.depth_,
+            first, f);
+        return;
+    }
+    for (std::size_t z = 0; z < block.depth_; ++z)
+    {
+        float_type* const first =
+            block.values_ + z * block.pixel_stride_ + block.first_pixel_;
+        std::transform(first, first + block.pixel_count_, first, f);
+    }
+}
+
+// Adds the bias of each channel to a block of output pixels
+// and applies the epilogue (if any) to it.
+inline void finish_pixel_block(const float_vec& biases,
+    const pixel_block_transform& epilogue, const pixel_block& block)
+{
+    assertion(biases.size() == block.depth_, "invalid number of biases");
+    if (channels_last_layout)
+    {
+        for (std::size_t i = 0; i < block.pixel_count_; ++i)
+        {
+            float_type* const pixel =
+                block.values_ + (block.first_pixel_ + i) * block.depth_;
+            for (std::size_t z = 0; z < block.depth_; ++z)
+            {
+                pixel[z] += biases[z];
+            }
+        }
+    }
+    else
+    {
+        for (std::size_t z = 0; z < block.depth_; ++z)
+        {
+            float_type* const first =
+                block.values_ + z * block.pixel_stride_ + block.first_pixel_;
+            const float_type bias = biases[z];
+            for (std::size_t i = 0; i < block.pixel_count_; ++i)
+            {
+                first[i] += bias;
+            }
+        }
+    }
+    if (epilogue)
+    {
+        epilogue(block);
+    }
+}
+
+inline pixel_block tensor3_pixel_block(tensor3& t)
+{
+    const std::size_t area = t.shape().height_ * t.shape().width_;
+    return {t.as_vector()->data(), t.shape().depth_, area, 0, area};
 }
 
 inline tensor3 tensor3_from_depth_slices(const std::vector<tensor2>& ms)
@@ -154,8 +556,8 @@ inline std::vector<tensor2> tensor3_to_tensor_2_depth_slices(const tensor3& m)
 
 inline tensor3 tensor2_to_tensor3(const tensor2& m)
 {
-    return tensor3(shape3(1, m.shape().height_, m.shape().width_),
-        m.as_vector());
+    return tensor3(storage_order_tag(),
+        shape3(1, m.shape().height_, m.shape().width_), m.as_vector());
 }
 
 inline std::pair<tensor3_pos, tensor3_pos> tensor3_min_max_pos(
@@ -204,7 +606,29 @@ inline tensor3 concatenate_tensor3s(const tensor3s& ts)
     const std::size_t depth_sum = fplus::sum(fplus::transform(
         fplus_c_mem_fn_t(tensor3, depth, std::size_t), ts));
 
-    return tensor3(
+    if (channels_last_layout)
+    {
+        // The channels of each pixel are taken from all tensors in turn.
+        const std::size_t area = ts.front().shape().without_depth().area();
+        float_vec values;
+        values.reserve(depth_sum * area);
+        for (std::size_t p = 0; p < area; ++p)
+        {
+            for (const auto& t : ts)
+            {
+                const auto first = t.as_vector()->begin() +
+                    static_cast<std::ptrdiff_t>(p * t.depth());
+                values.insert(values.end(), first,
+                    first + static_cast<std::ptrdiff_t>(t.depth()));
+            }
+        }
+        return tensor3(storage_order_tag(),
+            shape3(depth_sum,
+                ts.front().shape().height_, ts.front().shape().width_),
+            std::move(values));
+    }
+
+    return tensor3(storage_order_tag(),
         shape3(depth_sum,
             ts.front().shape().height_, ts.front().shape().width_),
         fplus::transform_and_concat([](const tensor3& t) -> float_vec
@@ -215,6 +639,12 @@ inline tensor3 concatenate_tensor3s(const tensor3s& ts)
 
 inline tensor3 flatten_tensor3(const tensor3& vol)
 {
+    if (channels_last_layout)
+    {
+        // Already stored in the order of flattening.
+        return tensor3(storage_order_tag(),
+            shape3(vol.shape().volume(), 1, 1), float_vec(*vol.as_vector()));
+    }
     float_vec values;
     values.reserve(vol.shape().volume());
     for (std::size_t y = 0; y < vol.shape().height_; ++y)
@@ -227,7 +657,8 @@ inline tensor3 flatten_tensor3(const tensor3& vol)
             }
         }
     }
-    return tensor3(shape3(values.size(), 1, 1), std::move(values));
+    return tensor3(storage_order_tag(), shape3(values.size(), 1, 1),
+        std::move(values));
 }
 
 inline tensor3 pad_tensor3(float_type val,
@@ -257,21 +688,8 @@ inline tensor3 crop_tensor3(
     std::size_t left_crop, std::size_t right_crop,
     const tensor3& in)
 {
-    tensor3 result(shape3(
-        in.shape().depth_,
-        in.shape().height_ - (top_crop + bottom_crop),
-        in.shape().width_ - (left_crop + right_crop)), 0);
-    for (std::size_t z = 0; z < result.shape().depth_; ++z)
-    {
-        for (std::size_t y = 0; y < result.shape().height_; ++y)
-        {
-            for (std::size_t x = 0; x < result.shape().width_; ++x)
-            {
-                result.set(z, y, x, in.get(z, y + top_crop, x + left_crop));
-            }
-        }
-    }
-    return result;
+    return tensor3_from_view(crop_tensor3_view(
+        top_crop, bottom_crop, left_crop, right_crop, tensor3_view(in)));
 }
 
 inline tensor3 dilate_tensor3(const shape2& dilation_rate, const tensor3& in)
@@ -357,7 +775,8 @@ inline tensor3 sum_tensor3s(const tensor3s& ts)
         }
         result_values.push_back(sum_val);
     }
-    return tensor3(ts.front().shape(), std::move(result_values));
+    return tensor3(storage_order_tag(), ts.front().shape(),
+        std::move(result_values));
 }
 
 inline tensor3 max_tensor3s(const tensor3s& ts)
@@ -379,7 +798,8 @@ inline tensor3 max_tensor3s(const tensor3s& ts)
         }
         result_values.push_back(max_val);
     }
-    return tensor3(ts.front().shape(), std::move(result_values));
+    return tensor3(storage_order_tag(), ts.front().shape(),
+        std::move(result_values));
 }
 
 } // namespace internal
@@ -389,10 +809,12 @@ using float_vec = internal::float_vec;
 using shared_float_vec = internal::shared_float_vec;
 using tensor3 = internal::tensor3;
 using tensor3s = internal::tensor3s;
+using tensor3_view = internal::tensor3_view;
+using tensor3_views = internal::tensor3_views;
 
 inline std::string show_tensor3(const tensor3& t)
 {
-    const auto xs = *t.as_vector();
+    const auto xs = internal::depth_first_values(t);
     const auto test_strs = fplus::transform(
         fplus::fwd::show_float_fill_left(' ', 0, 4), xs);
     const auto max_length = fplus::size_of_cont(fplus::maximum_on(
@@ -427,8 +849,14 @@ inline tensor3 tensor3_from_bytes(const std::uint8_t* value_ptr,
             static_cast<float_type>(255.0f),
             static_cast<internal::float_type>(b));
     }, bytes);
+    if (internal::channels_last_layout)
+    {
+        return tensor3(internal::storage_order_tag(),
+            shape3(channels, height, width), std::move(values));
+    }
     return internal::depth_last_to_depth_first(
-        tensor3(shape3(height, width, channels), std::move(values)));
+        tensor3(internal::storage_order_tag(),
+            shape3(height, width, channels), std::move(values)));
 }
 
 // Converts a tensor3 into a memory block holding 8-bit values.
@@ -439,7 +867,8 @@ inline void tensor3_into_bytes(const tensor3& t, std::uint8_t* value_ptr,
     std::size_t bytes_available,
     internal::float_type low = 0.0f, internal::float_type high = 1.0f)
 {
-    const auto values = depth_first_to_depth_last(t).as_vector();
+    const auto values = internal::channels_last_layout ?
+        t.as_vector() : depth_first_to_depth_last(t).as_vector();
     internal::assertion(bytes_available == values->size(),
     "invalid buffer size");
     const auto bytes = fplus::transform(
@@ -470,23 +899,13 @@ inline std::vector<std::uint8_t> tensor3_to_bytes(const tensor3& t,
 // Return one tensor3 with depth 1 for every depth slice of a given tensor3.
 inline std::vector<tensor3> tensor3_to_depth_slices(const tensor3& m)
 {
+    const internal::tensor3_view view(m);
     std::vector<tensor3> ms;
     ms.reserve(m.shape().depth_);
-    for (std::size_t i = 0; i < m.shape().depth_; ++i)
-    {
-        ms.push_back(tensor3(
-            shape3(1, m.shape().height_, m.shape().width_), 0));
-    }
-
     for (std::size_t z = 0; z < m.shape().depth_; ++z)
     {
-        for (std::size_t y = 0; y < m.shape().height_; ++y)
-        {
-            for (std::size_t x = 0; x < m.shape().width_; ++x)
-            {
-                ms[z].set(0, y, x, m.get(z, y, x));
-            }
-        }
+        ms.push_back(internal::tensor3_from_view(
+            internal::depth_slice_view(z, view)));
     }
     return ms;
 }
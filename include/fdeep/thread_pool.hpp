@@ -0,0 +1,381 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include "fdeep/common.hpp"
+
+#include "fdeep/tracing.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace fdeep { namespace internal
+{
+
+class thread_pool;
+
+// How the work of a forward pass started from the current thread
+// may be distributed over the threads of pool_.
+// layers_: Independent branches of the computational graph.
+// ops_: Blocks of the output values of single layers.
+struct parallelization
+{
+    thread_pool* pool_;
+    bool layers_;
+    bool ops_;
+};
+
+inline parallelization& current_parallelization()
+{
+    static thread_local parallelization current = {nullptr, false, false};
+    return current;
+}
+
+// Sets current_parallelization for the lifetime of the scope.
+class parallelization_scope
+{
+public:
+    explicit parallelization_scope(const parallelization& p) :
+        previous_(current_parallelization())
+    {
+        current_parallelization() = p;
+    }
+    ~parallelization_scope()
+    {
+        current_parallelization() = previous_;
+    }
+    parallelization_scope(const parallelization_scope&) = delete;
+    parallelization_scope& operator=(const parallelization_scope&) = delete;
+private:
+    parallelization previous_;
+};
+
+// A fixed number of worker threads, each with its own task deque.
+// Workers push new tasks to their own deque and take them from its back.
+// When it is empty, they steal from the front of the other ones.
+// Tasks submitted from other threads go to one extra shared deque.
+// Threads waiting for a task_group run pending tasks in the meantime,
+// so tasks may themselves start and wait for further tasks.
+// Posted tasks (e.g. whole forward passes) wait in a separate queue,
+// which only idle workers take from, so a short wait never ends up
+// running one of them.
+class thread_pool
+{
+public:
+    explicit thread_pool(std::size_t thread_count) :
+        queues_(), queued_(0), posted_(), posted_count_(0), stop_(false),
+        sleep_mutex_(), sleep_cond_(), threads_()
+    {
+        assertion(thread_count > 0, "thread pool needs at least one thread");
+        for (std::size_t i = 0; i < thread_count + 1; ++i)
+        {
+            queues_.push_back(std::make_unique<task_queue>());
+        }
+        for (std::size_t i = 0; i < thread_count; ++i)
+        {
+            threads_.emplace_back([this, i]() { work(i); });
+        }
+    }
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        sleep_cond_.notify_all();
+        for (auto& thread : threads_)
+        {
+            thread.join();
+        }
+    }
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    std::size_t thread_count() const
+    {
+        return threads_.size();
+    }
+
+    // Runs task on one of the threads without waiting for it.
+    // It must not throw. Tasks still queued when the pool is destroyed
+    // are run before its threads stop.
+    void post(const std::function<void()>& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(posted_.mutex_);
+            posted_.tasks_.push_back(task);
+            ++posted_count_;
+        }
+        notify();
+    }
+
+private:
+    friend class task_group;
+
+    typedef std::function<void()> task;
+
+    struct task_queue
+    {
+        task_queue() : mutex_(), tasks_() {}
+        std::mutex mutex_;
+        std::deque<task> tasks_;
+    };
+
+    static std::pair<const thread_pool*, std::size_t>& current_worker()
+    {
+        static thread_local std::pair<const thread_pool*, std::size_t>
+            worker(nullptr, 0);
+        return worker;
+    }
+
+    // Own deque for workers of this pool, the shared one otherwise.
+    std::size_t own_queue_idx() const
+    {
+        return current_worker().first == this ?
+            current_worker().second : threads_.size();
+    }
+
+    void submit(const task& t)
+    {
+        {
+            task_queue& queue = *queues_[own_queue_idx()];
+            std::lock_guard<std::mutex> lock(queue.mutex_);
+            queue.tasks_.push_back(t);
+            ++queued_;
+        }
+        notify();
+    }
+
+    // Wakes up all sleeping threads, since the one waiting
+    // for a specific task_group might need to be among them.
+    void notify()
+    {
+        {
+            // Prevents the notification from slipping through
+            // between a sleeper checking its condition and waiting.
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+        sleep_cond_.notify_all();
+    }
+
+    // Tasks of task_groups come first, posted ones only if allowed.
+    bool try_pop(task& t, bool take_posted)
+    {
+        const std::size_t own_idx = own_queue_idx();
+        for (std::size_t i = 0; i < queues_.size(); ++i)
+        {
+            task_queue& queue = *queues_[(own_idx + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex_);
+            if (queue.tasks_.empty())
+            {
+                continue;
+            }
+            if (i == 0)
+            {
+                t = std::move(queue.tasks_.back());
+                queue.tasks_.pop_back();
+            }
+            else
+            {
+                t = std::move(queue.tasks_.front());
+                queue.tasks_.pop_front();
+            }
+            --queued_;
+            return true;
+        }
+        if (take_posted)
+        {
+            std::lock_guard<std::mutex> lock(posted_.mutex_);
+            if (!posted_.tasks_.empty())
+            {
+                t = std::move(posted_.tasks_.front());
+                posted_.tasks_.pop_front();
+                --posted_count_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs pending tasks until done() holds.
+    void run_until(const std::function<bool()>& done, bool take_posted)
+    {
+        task t;
+        while (!done())
+        {
+            if (try_pop(t, take_posted))
+            {
+                t();
+                t = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_cond_.wait(lock, [this, &done, take_posted]() -> bool
+            {
+                return queued_ > 0 || (take_posted && posted_count_ > 0) ||
+                    done();
+            });
+        }
+    }
+
+    void work(std::size_t idx)
+    {
+        current_worker() = std::make_pair(this, idx);
+        run_until([this]() -> bool
+        {
+            return stop_ && queued_ == 0 && posted_count_ == 0;
+        }, true);
+    }
+
+    std::vector<std::unique_ptr<task_queue>> queues_;
+    std::atomic<std::size_t> queued_;
+    task_queue posted_;
+    std::atomic<std::size_t> posted_count_;
+    std::atomic<bool> stop_;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cond_;
+    std::vector<std::thread> threads_;
+};
+
+// Tasks run on a thread_pool, which can be waited for together.
+// They see the parallelization and tracer of the thread starting them.
+// The first exception thrown by a task is rethrown by wait.
+class task_group
+{
+public:
+    explicit task_group(thread_pool& pool) :
+        pool_(pool), pending_(0), error_mutex_(), error_(nullptr)
+    {
+    }
+    ~task_group()
+    {
+        pool_.run_until([this]() -> bool
+        {
+            return pending_ == 0;
+        }, false);
+    }
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    void run(const std::function<void()>& task)
+    {
+        ++pending_;
+        thread_pool& pool = pool_;
+        const parallelization context = current_parallelization();
+        tracer* const trace = current_tracer();
+        pool_.submit([this, &pool, context, trace, task]()
+        {
+            try
+            {
+                const parallelization_scope scope(context);
+                const tracer_scope trace_scope(trace);
+                task();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex_);
+                if (error_ == nullptr)
+                {
+                    error_ = std::current_exception();
+                }
+            }
+            --pending_;
+            // The group might be gone already, the pool is still there.
+            pool.notify();
+        });
+    }
+
+    void wait()
+    {
+        pool_.run_until([this]() -> bool
+        {
+            return pending_ == 0;
+        }, false);
+        std::exception_ptr error = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+            std::swap(error, error_);
+        }
+        if (error != nullptr)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    thread_pool& pool_;
+    std::atomic<std::size_t> pending_;
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+};
+
+// Process-wide pool for parallel work of models without their own one.
+// Its size can be changed with set_default_thread_count.
+inline std::shared_ptr<thread_pool>& default_thread_pool_instance()
+{
+    static std::shared_ptr<thread_pool> pool = nullptr;
+    return pool;
+}
+
+inline std::mutex& default_thread_pool_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline std::shared_ptr<thread_pool> default_thread_pool()
+{
+    std::lock_guard<std::mutex> lock(default_thread_pool_mutex());
+    auto& pool = default_thread_pool_instance();
+    if (pool == nullptr)
+    {
+        const std::size_t cores = std::thread::hardware_concurrency();
+        pool = std::make_shared<thread_pool>(cores > 1 ? cores - 1 : 1);
+    }
+    return pool;
+}
+
+// Calls f(i) for every i in [0, n), distributed over the current
+// thread pool if the parallelization of operations is enabled.
+inline void parallel_for(std::size_t n,
+    const std::function<void(std::size_t)>& f)
+{
+    const parallelization& context = current_parallelization();
+    if (context.pool_ == nullptr || !context.ops_ || n < 2)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            f(i);
+        }
+        return;
+    }
+    task_group tasks(*context.pool_);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        tasks.run([&f, i]() { f(i); });
+    }
+    tasks.wait();
+}
+
+// Number of threads parallel_for can use at the moment.
+inline std::size_t parallel_op_thread_count()
+{
+    const parallelization& context = current_parallelization();
+    return context.pool_ == nullptr || !context.ops_ ?
+        1 : context.pool_->thread_count() + 1;
+}
+
+} } // namespace fdeep, namespace internal
@@ -0,0 +1,162 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include "fdeep/common.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fdeep { namespace internal
+{
+
+// One finished span of a timeline, times in microseconds
+// since the creation of the tracer.
+struct trace_event
+{
+    std::string name_;
+    std::string category_;
+    std::size_t thread_idx_;
+    double start_;
+    double duration_;
+};
+
+// Collects the spans of the forward passes running on any thread
+// while it is the current_tracer. Threads are numbered in the order
+// of their first span.
+class tracer
+{
+public:
+    tracer() :
+        start_(std::chrono::steady_clock::now()),
+        mutex_(), events_(), thread_indices_()
+    {
+    }
+
+    double now() const
+    {
+        return std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start_).count();
+    }
+
+    void record(const char* name, const char* category,
+        double start, double end)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto id = std::this_thread::get_id();
+        const auto it = thread_indices_.find(id);
+        const std::size_t thread_idx = it != thread_indices_.end() ?
+            it->second : thread_indices_.size();
+        thread_indices_[id] = thread_idx;
+        events_.push_back({name, category, thread_idx, start, end - start});
+    }
+
+    // Chrome Trace Event Format, as understood by chrome://tracing
+    // and the Perfetto UI.
+    std::string to_json() const
+    {
+        const auto quote = [](const std::string& str) -> std::string
+        {
+            std::string result = "\"";
+            for (const char c : str)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    result += '\\';
+                }
+                result += c;
+            }
+            return result + "\"";
+        };
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+        for (std::size_t i = 0; i < events_.size(); ++i)
+        {
+            const auto& event = events_[i];
+            out << (i == 0 ? "\n" : ",\n")
+                << "{\"name\":" << quote(event.name_)
+                << ",\"cat\":" << quote(event.category_)
+                << ",\"ph\":\"X\",\"pid\":1"
+                << ",\"tid\":" << event.thread_idx_
+                << ",\"ts\":" << event.start_
+                << ",\"dur\":" << event.duration_ << "}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return out.str();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+    mutable std::mutex mutex_;
+    std::vector<trace_event> events_;
+    std::map<std::thread::id, std::size_t> thread_indices_;
+};
+
+// Spans are only recorded if this is set,
+// otherwise checking it is all tracing costs.
+inline tracer*& current_tracer()
+{
+    static thread_local tracer* current = nullptr;
+    return current;
+}
+
+// Sets current_tracer for the lifetime of the scope.
+class tracer_scope
+{
+public:
+    explicit tracer_scope(tracer* t) :
+        previous_(current_tracer())
+    {
+        current_tracer() = t;
+    }
+    ~tracer_scope()
+    {
+        current_tracer() = previous_;
+    }
+    tracer_scope(const tracer_scope&) = delete;
+    tracer_scope& operator=(const tracer_scope&) = delete;
+private:
+    tracer* previous_;
+};
+
+// Records the lifetime of the object as a span of the current_tracer.
+// name and category must outlive it.
+class trace_span
+{
+public:
+    trace_span(const char* name, const char* category) :
+        tracer_(current_tracer()),
+        name_(name),
+        category_(category),
+        start_(tracer_ == nullptr ? 0 : tracer_->now())
+    {
+    }
+    ~trace_span()
+    {
+        if (tracer_ != nullptr)
+        {
+            tracer_->record(name_, category_, start_, tracer_->now());
+        }
+    }
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+private:
+    tracer* tracer_;
+    const char* name_;
+    const char* category_;
+    double start_;
+};
+
+} } // namespace fdeep, namespace internal
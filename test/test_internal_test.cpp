@@ -0,0 +1,293 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+#include <fdeep/fdeep.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+// Tensor holding the values of f for the indices of its values.
+template <typename F>
+fdeep::tensor3 generate_tensor3(const fdeep::shape3& shape, F f)
+{
+    fdeep::float_vec values(shape.volume());
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        values[i] = f(i);
+    }
+    return fdeep::tensor3(shape, std::move(values));
+}
+
+TEST_CASE("test_internal_test, tensor3_view")
+{
+    const auto t = generate_tensor3(fdeep::shape3(2, 3, 4),
+        [](std::size_t i) { return static_cast<fdeep::float_type>(i); });
+    const fdeep::tensor3_view view(t);
+    const auto slice = fdeep::internal::depth_slice_view(1, view);
+    REQUIRE(slice.values()->data() == t.as_vector()->data());
+    REQUIRE(slice.get(0, 2, 3) == t.get(1, 2, 3));
+    const auto cropped = fdeep::internal::crop_tensor3(1, 0, 1, 2, t);
+    REQUIRE(cropped.shape() == fdeep::shape3(2, 2, 1));
+    REQUIRE(cropped.get(1, 1, 0) == t.get(1, 2, 1));
+    const auto slices = fdeep::tensor3_to_depth_slices(t);
+    REQUIRE(slices.size() == 2);
+    REQUIRE(slices[1].get(0, 2, 3) == t.get(1, 2, 3));
+}
+
+TEST_CASE("test_internal_test, tensor3_from_std_vector")
+{
+    // Code written before tensor3 used an aligned float_vec still builds.
+    const std::vector<fdeep::float_type> values = {1, 2, 3, 4, 5, 6};
+    const fdeep::shape3 shape(1, 2, 3);
+    const fdeep::tensor3 copied(shape, values);
+    const fdeep::tensor3 moved(shape,
+        std::vector<fdeep::float_type>(values));
+    const fdeep::tensor3 listed(shape, {1, 2, 3, 4, 5, 6});
+    for (const auto& t : {copied, moved, listed})
+    {
+        REQUIRE(fdeep::internal::depth_first_values(t) ==
+            fdeep::float_vec(values.begin(), values.end()));
+    }
+}
+
+TEST_CASE("test_internal_test, in_place_concatenation")
+{
+    using namespace fdeep::internal;
+    const auto relu_1 = std::make_shared<relu_layer>("relu_1");
+    const auto relu_2 = std::make_shared<relu_layer>("relu_2");
+    const auto concat = std::make_shared<concatenate_layer>("concat");
+    relu_1->set_nodes({node({node_connection("in", 0, 0)})});
+    relu_2->set_nodes({node({node_connection("in", 0, 0)})});
+    concat->set_nodes({node({node_connection("relu_1", 0, 0),
+        node_connection("in", 0, 0), node_connection("relu_2", 0, 0)})});
+    const auto plan = compile_execution_plan({relu_1, relu_2, concat},
+        {node_connection("in", 0, 0)}, {node_connection("concat", 0, 0)});
+    if (!channels_last_layout)
+    {
+        REQUIRE(plan.steps_.back().in_place_inputs_ ==
+            std::vector<bool>({true, false, true}));
+    }
+
+    const auto input = generate_tensor3(fdeep::shape3(2, 3, 2),
+        [](std::size_t i) { return static_cast<fdeep::float_type>(i) - 6; });
+    const auto activated = relu_1->apply({input}).front();
+    const auto expected = concatenate_tensor3s({activated, input, activated});
+    thread_pool pool(2);
+    for (const auto& output : {run_execution_plan(plan, {input}),
+        run_execution_plan_parallel(plan, {input}, pool)})
+    {
+        REQUIRE(output.size() == 1);
+        REQUIRE(output.front().shape() == expected.shape());
+        REQUIRE(*output.front().as_vector() == *expected.as_vector());
+    }
+}
+
+TEST_CASE("test_internal_test, in_place_steps")
+{
+    using namespace fdeep::internal;
+    const auto add = std::make_shared<add_layer>("add");
+    const auto relu = std::make_shared<relu_layer>("relu");
+    const auto bn = std::make_shared<batch_normalization_layer>("bn",
+        float_vec({1, -1}), float_vec({4, 1}), float_vec({0, 2}),
+        float_vec({2, 3}), static_cast<fdeep::float_type>(0));
+    add->set_nodes({node({node_connection("in", 0, 0),
+        node_connection("in", 0, 0)})});
+    relu->set_nodes({node({node_connection("add", 0, 0)})});
+    bn->set_nodes({node({node_connection("relu", 0, 0)})});
+    const auto plan = compile_execution_plan({add, relu, bn},
+        {node_connection("in", 0, 0)}, {node_connection("bn", 0, 0)});
+    REQUIRE(plan.steps_.size() == 3);
+    REQUIRE(!plan.steps_[0].in_place_);
+    REQUIRE(plan.steps_[1].in_place_);
+    REQUIRE(plan.steps_[2].in_place_);
+
+    const auto input = generate_tensor3(fdeep::shape3(2, 3, 2),
+        [](std::size_t i) { return static_cast<fdeep::float_type>(i) - 6; });
+    const auto input_values = *input.as_vector();
+    const auto expected = bn->apply(relu->apply(add->apply({input, input})));
+    thread_pool pool(2);
+    for (const auto& output : {run_execution_plan(plan, {input}),
+        run_execution_plan_parallel(plan, {input}, pool)})
+    {
+        REQUIRE(output.size() == 1);
+        REQUIRE(*output.front().as_vector() ==
+            *expected.front().as_vector());
+    }
+    REQUIRE(*input.as_vector() == input_values);
+}
+
+TEST_CASE("test_internal_test, pointwise_convolution")
+{
+    using namespace fdeep::internal;
+    const auto make_tensor = [](const shape3& shape, float_type scale)
+    {
+        return generate_tensor3(shape, [scale](std::size_t i)
+        {
+            return scale * static_cast<float_type>(i % 11) - 1;
+        });
+    };
+    const filter_vec filters = {
+        filter(make_tensor(shape3(3, 1, 1), 0.5f), 1),
+        filter(make_tensor(shape3(3, 1, 1), -0.25f), -2)};
+    const auto filter_mat = generate_im2col_filter_matrix(filters);
+    const tensor3s inputs = {make_tensor(shape3(3, 4, 5), 0.1f),
+        make_tensor(shape3(3, 4, 5), -0.2f)};
+    // The block of pixels spanning both inputs is split per input.
+    const auto outputs = fplus::append(
+        convolve(shape2(1, 1), padding::same, false, filter_mat, inputs),
+        tensor3s({
+            convolve(shape2(1, 1), padding::same, false, filter_mat,
+                inputs[0]),
+            convolve(shape2(1, 1), padding::valid, false, filter_mat,
+                inputs[1])}));
+    REQUIRE(outputs.size() == 2 * inputs.size());
+    for (std::size_t j = 0; j < outputs.size(); ++j)
+    {
+        const std::size_t i = j % inputs.size();
+        REQUIRE(outputs[j].shape() == shape3(2, 4, 5));
+        for (std::size_t f = 0; f < filters.size(); ++f)
+        {
+            for (std::size_t y = 0; y < 4; ++y)
+            {
+                for (std::size_t x = 0; x < 5; ++x)
+                {
+                    float_type expected = filters[f].get_bias();
+                    for (std::size_t z = 0; z < 3; ++z)
+                    {
+                        expected += filters[f].get(z, 0, 0) *
+                            inputs[i].get(z, y, x);
+                    }
+                    REQUIRE(std::abs(outputs[j].get(f, y, x) - expected) <
+                        0.0001f);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("test_internal_test, depthwise_convolution")
+{
+    using namespace fdeep::internal;
+    const std::size_t depth = 3;
+    filter_vec filters;
+    for (std::size_t z = 0; z < depth; ++z)
+    {
+        filters.push_back(filter(generate_tensor3(shape3(1, 3, 2),
+            [z](std::size_t i)
+            {
+                return static_cast<float_type>(i * (z + 1) % 5) - 2;
+            }), static_cast<float_type>(z)));
+    }
+    const auto filter_mat = generate_depthwise_filter_matrix(filters);
+    tensor3s inputs;
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        inputs.push_back(generate_tensor3(shape3(depth, 7, 6),
+            [i](std::size_t j)
+            {
+                return static_cast<float_type>((j + i) % 9) / 4 - 1;
+            }));
+    }
+    for (const auto& strides : {shape2(1, 1), shape2(2, 1), shape2(2, 3)})
+    {
+        for (const auto pad_type : {padding::valid, padding::same})
+        {
+            for (const bool use_offset : {false, true})
+            {
+                const auto outputs = depthwise_convolve(strides, pad_type,
+                    use_offset, filter_mat, tensor3_views_of(inputs));
+                REQUIRE(outputs.size() == inputs.size());
+                for (std::size_t i = 0; i < inputs.size(); ++i)
+                {
+                    // Each channel convolved on its own.
+                    tensor3s slices;
+                    for (std::size_t z = 0; z < depth; ++z)
+                    {
+                        slices.push_back(convolve(strides, pad_type,
+                            use_offset,
+                            generate_im2col_single_filter_matrix(filters[z]),
+                            tensor3_from_view(
+                                depth_slice_view(z, tensor3_view(inputs[i])))));
+                    }
+                    const auto expected = concatenate_tensor3s(slices);
+                    REQUIRE(outputs[i].shape() == expected.shape());
+                    const auto& values = *outputs[i].as_vector();
+                    const auto& expected_values = *expected.as_vector();
+                    for (std::size_t j = 0; j < values.size(); ++j)
+                    {
+                        REQUIRE(std::abs(values[j] - expected_values[j]) <
+                            0.0001f);
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("test_internal_test, profiled_output_bytes")
+{
+    using namespace fdeep::internal;
+    const auto add = std::make_shared<add_layer>("add");
+    const auto relu = std::make_shared<relu_layer>("relu");
+    add->set_nodes({node({node_connection("in", 0, 0),
+        node_connection("in", 0, 0)})});
+    relu->set_nodes({node({node_connection("add", 0, 0)})});
+    const auto plan = compile_execution_plan({add, relu},
+        {node_connection("in", 0, 0)}, {node_connection("relu", 0, 0)});
+    REQUIRE(plan.steps_[1].in_place_);
+
+    const auto input = generate_tensor3(fdeep::shape3(2, 3, 2),
+        [](std::size_t i) { return static_cast<fdeep::float_type>(i) - 6; });
+    profiler prof;
+    {
+        const profiler_scope scope(&prof);
+        run_execution_plan(plan, {input});
+    }
+    // The in-place step allocates nothing.
+    const auto profiles = prof.report();
+    REQUIRE(profiles.size() == 2);
+    for (const auto& profile : profiles)
+    {
+        REQUIRE(profile.output_bytes_ == (profile.name_ == "add" ?
+            input.shape().volume() * sizeof(float_type) : 0));
+    }
+}
+
+TEST_CASE("test_internal_test, posted_tasks")
+{
+    using namespace fdeep::internal;
+    thread_pool pool(1);
+    std::atomic<bool> started(false);
+    std::atomic<bool> released(false);
+    task_group tasks(pool);
+    tasks.run([&]()
+    {
+        started = true;
+        while (!released)
+        {
+            std::this_thread::yield();
+        }
+    });
+    while (!started)
+    {
+        std::this_thread::yield();
+    }
+    std::promise<std::thread::id> posted_thread;
+    pool.post([&]() { posted_thread.set_value(std::this_thread::get_id()); });
+    std::thread releaser([&]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        released = true;
+    });
+    // Waiting for the group does not run the posted task.
+    tasks.wait();
+    releaser.join();
+    REQUIRE(posted_thread.get_future().get() != std::this_thread::get_id());
+}
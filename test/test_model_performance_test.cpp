@@ -0,0 +1,253 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+// Fails if the median latency or the peak heap allocation of a forward
+// pass exceeds the budget stored in test/performance_budgets.json.
+// Latencies are stored relative to a matrix product timed right before
+// each model, so the budgets hold on machines faster or slower than the
+// one they were measured on.
+// Run with FDEEP_UPDATE_PERFORMANCE_BUDGETS=1 (target
+// update_performance_budgets) to store the measured values instead.
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+#include <fdeep/fdeep.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifndef FDEEP_PERFORMANCE_BUDGETS
+#define FDEEP_PERFORMANCE_BUDGETS "../../test/performance_budgets.json"
+#endif
+
+namespace
+{
+
+std::atomic<std::size_t> allocated_bytes(0);
+std::atomic<std::size_t> peak_allocated_bytes(0);
+
+// Every allocation is prefixed with its size.
+const std::size_t allocation_header = alignof(std::max_align_t);
+
+void* tracked_allocate(std::size_t size)
+{
+    void* const block = std::malloc(size + allocation_header);
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+    *static_cast<std::size_t*>(block) = size;
+    const std::size_t current = allocated_bytes += size;
+    std::size_t peak = peak_allocated_bytes;
+    while (current > peak &&
+        !peak_allocated_bytes.compare_exchange_weak(peak, current))
+    {
+    }
+    return static_cast<char*>(block) + allocation_header;
+}
+
+void tracked_free(void* ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    void* const block = static_cast<char*>(ptr) - allocation_header;
+    allocated_bytes -= *static_cast<std::size_t*>(block);
+    std::free(block);
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    void* const ptr = tracked_allocate(size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return tracked_allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return tracked_allocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    tracked_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    tracked_free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    tracked_free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    tracked_free(ptr);
+}
+
+namespace
+{
+
+struct performance_measurement
+{
+    std::string name_;
+    std::string file_;
+    double median_latency_ms_;
+    double reference_latency_ms_;
+    std::size_t peak_allocation_bytes_;
+};
+
+double median_ms(std::vector<double> latencies)
+{
+    std::sort(std::begin(latencies), std::end(latencies));
+    return 1000 * latencies[latencies.size() / 2];
+}
+
+// Median latency of a fixed-size matrix product,
+// the unit the model latencies are measured in.
+double measure_reference(std::size_t iterations)
+{
+    using fdeep::internal::RowMajorMatrixXf;
+    const RowMajorMatrixXf a = RowMajorMatrixXf::Random(256, 256);
+    const RowMajorMatrixXf b = RowMajorMatrixXf::Random(256, 256);
+    RowMajorMatrixXf c = a * b;
+
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        fplus::stopwatch stopwatch;
+        c.noalias() = a * b;
+        latencies.push_back(stopwatch.elapsed());
+    }
+    REQUIRE(c.allFinite());
+    return median_ms(latencies);
+}
+
+// Median latency over the given number of forward passes and the highest
+// amount of heap memory allocated in addition during one of them.
+performance_measurement measure(const std::string& name,
+    const std::string& file, std::size_t iterations)
+{
+    const double reference_latency_ms = measure_reference(iterations);
+    // Without the buffer pool every buffer comes from operator new.
+    fdeep::set_buffer_pool_limit(0);
+    const auto model = fdeep::load_model("../" + file, false);
+    const auto inputs = model.generate_dummy_inputs();
+    model.predict(inputs);
+
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+    std::size_t peak_allocation = 0;
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        const std::size_t before = allocated_bytes;
+        peak_allocated_bytes = before;
+        fplus::stopwatch stopwatch;
+        model.predict(inputs);
+        latencies.push_back(stopwatch.elapsed());
+        peak_allocation = std::max(peak_allocation,
+            peak_allocated_bytes - before);
+    }
+    return {name, file, median_ms(latencies), reference_latency_ms,
+        peak_allocation};
+}
+
+std::string show_budgets(const nlohmann::json& budgets,
+    const std::vector<performance_measurement>& measurements)
+{
+    nlohmann::json result = budgets;
+    result["models"] = nlohmann::json::array();
+    for (const auto& m : measurements)
+    {
+        nlohmann::json model;
+        model["name"] = m.name_;
+        model["file"] = m.file_;
+        model["relative_latency"] =
+            m.median_latency_ms_ / m.reference_latency_ms_;
+        model["peak_allocation_bytes"] = m.peak_allocation_bytes_;
+        result["models"].push_back(model);
+    }
+    return result.dump(4) + "\n";
+}
+
+} // namespace
+
+TEST_CASE("test_model_performance_test, budgets")
+{
+    const auto maybe_json_str =
+        fplus::read_text_file_maybe(FDEEP_PERFORMANCE_BUDGETS)();
+    REQUIRE(fplus::is_just(maybe_json_str));
+    const auto budgets = nlohmann::json::parse(
+        maybe_json_str.unsafe_get_just());
+    const auto iterations = budgets["iterations"].get<std::size_t>();
+    const auto latency_tolerance =
+        budgets["latency_tolerance"].get<double>();
+    const auto allocation_tolerance =
+        budgets["allocation_tolerance"].get<double>();
+
+    std::vector<performance_measurement> measurements;
+    bool within_budgets = true;
+    for (const auto& budget : budgets["models"])
+    {
+        const auto m = measure(budget["name"].get<std::string>(),
+            budget["file"].get<std::string>(), iterations);
+        measurements.push_back(m);
+        const double max_latency_ms = (1 + latency_tolerance) *
+            budget["relative_latency"].get<double>() *
+            m.reference_latency_ms_;
+        const double max_allocation = (1 + allocation_tolerance) *
+            budget["peak_allocation_bytes"].get<double>();
+        const bool ok = m.median_latency_ms_ <= max_latency_ms &&
+            static_cast<double>(m.peak_allocation_bytes_) <= max_allocation;
+        within_budgets = within_budgets && ok;
+        std::cout << std::fixed << std::setprecision(3)
+            << (ok ? "ok       " : "EXCEEDED ") << m.name_
+            << ": median latency " << m.median_latency_ms_
+            << " ms (max " << max_latency_ms << " ms, reference "
+            << m.reference_latency_ms_ << " ms)"
+            << ", peak allocation " << m.peak_allocation_bytes_
+            << " bytes (max " << std::setprecision(0) << max_allocation
+            << " bytes)" << std::endl;
+    }
+
+    if (std::getenv("FDEEP_UPDATE_PERFORMANCE_BUDGETS") != nullptr)
+    {
+        std::ofstream file(FDEEP_PERFORMANCE_BUDGETS);
+        file << show_budgets(budgets, measurements);
+        REQUIRE(file.good());
+        std::cout << "Updated " << FDEEP_PERFORMANCE_BUDGETS << std::endl;
+        return;
+    }
+    REQUIRE(within_budgets);
+}
@@ -8,6 +8,39 @@
 #include "doctest.h"
 #include <fdeep/fdeep.hpp>
 
+#include <future>
+#include <vector>
+
+// Runs a set of dummy inputs through run
+// and compares the results with sequential predictions.
+template <typename F>
+void check_against_sequential(const fdeep::model& model, F run)
+{
+    const auto multi_inputs = fplus::generate<std::vector<fdeep::tensor3s>>(
+        [&]() -> fdeep::tensor3s {return model.generate_dummy_inputs();},
+        10);
+    const auto expected = model.predict_multi(multi_inputs, false);
+    const std::vector<fdeep::tensor3s> outputs = run(multi_inputs);
+    REQUIRE(outputs.size() == expected.size());
+    for (std::size_t i = 0; i < outputs.size(); ++i)
+    {
+        fdeep::internal::check_test_outputs(
+            static_cast<fdeep::float_type>(0.00001), outputs[i], expected[i]);
+    }
+}
+
+// Waits for all of the futures.
+std::vector<fdeep::tensor3s> get_results(
+    std::vector<std::future<fdeep::tensor3s>>& futures)
+{
+    std::vector<fdeep::tensor3s> results;
+    for (auto& future : futures)
+    {
+        results.push_back(future.get());
+    }
+    return results;
+}
+
 TEST_CASE("test_model_small_test, load_model")
 {
     const auto model = fdeep::load_model("../test_model_small.json",
@@ -18,3 +51,168 @@ TEST_CASE("test_model_small_test, load_model")
     model.predict_multi(multi_inputs, false);
     model.predict_multi(multi_inputs, true);
 }
+
+TEST_CASE("test_model_small_test, parallelism")
+{
+    const auto model = fdeep::load_model("../test_model_small.json", false);
+    auto parallel_model = model;
+    parallel_model.set_parallelism(3);
+    check_against_sequential(model,
+        [&](const std::vector<fdeep::tensor3s>& multi_inputs)
+    {
+        return parallel_model.predict_multi(multi_inputs, true);
+    });
+}
+
+TEST_CASE("test_model_small_test, predict_batch")
+{
+    const auto model = fdeep::load_model("../test_model_small.json", false);
+    check_against_sequential(model,
+        [&](const std::vector<fdeep::tensor3s>& multi_inputs)
+    {
+        return model.predict_batch(multi_inputs);
+    });
+}
+
+TEST_CASE("test_model_small_test, predict_async")
+{
+    const auto model = fdeep::load_model("../test_model_small.json", false);
+    auto batching_model = model;
+    batching_model.set_micro_batching(4);
+    check_against_sequential(model,
+        [&](const std::vector<fdeep::tensor3s>& multi_inputs)
+    {
+        std::vector<std::future<fdeep::tensor3s>> futures;
+        for (const auto& inputs : multi_inputs)
+        {
+            futures.push_back(batching_model.predict_async(inputs));
+        }
+        return get_results(futures);
+    });
+    // Without micro-batching, on the model's own pool,
+    // which may be gone before the results are.
+    check_against_sequential(model,
+        [&](const std::vector<fdeep::tensor3s>& multi_inputs)
+    {
+        std::vector<std::future<fdeep::tensor3s>> futures;
+        {
+            auto own_model = model;
+            own_model.set_parallelism(2);
+            for (const auto& inputs : multi_inputs)
+            {
+                futures.push_back(own_model.predict_async(inputs));
+            }
+        }
+        return get_results(futures);
+    });
+}
+
+TEST_CASE("test_model_small_test, profiling")
+{
+    auto model = fdeep::load_model("../test_model_small.json", false);
+    model.set_profiling(true);
+    model.predict(model.generate_dummy_inputs());
+    model.predict(model.generate_dummy_inputs());
+    const auto profile = model.get_profile();
+    REQUIRE(!profile.empty());
+    for (const auto& layer_profile : profile)
+    {
+        REQUIRE(layer_profile.calls_ == 2);
+        REQUIRE(!layer_profile.type_.empty());
+    }
+}
+
+TEST_CASE("test_model_small_test, tracing")
+{
+    auto model = fdeep::load_model("../test_model_small.json", false);
+    model.set_tracing(true);
+    model.predict(model.generate_dummy_inputs());
+    const auto trace = model.get_trace_json();
+    REQUIRE(trace.find("\"traceEvents\"") != std::string::npos);
+    REQUIRE(trace.find("\"predict\"") != std::string::npos);
+}
+
+TEST_CASE("test_model_small_test, aligned_values")
+{
+    const auto model = fdeep::load_model("../test_model_small.json", false);
+    const auto outputs = model.predict(model.generate_dummy_inputs());
+    for (const auto& output : outputs)
+    {
+        REQUIRE(reinterpret_cast<std::uintptr_t>(output.as_vector()->data()) %
+            fdeep::internal::tensor_alignment == 0);
+    }
+}
+
+TEST_CASE("test_model_small_test, predict_views")
+{
+    const auto model = fdeep::load_model("../test_model_small.json", false);
+    check_against_sequential(model,
+        [&](const std::vector<fdeep::tensor3s>& multi_inputs)
+    {
+        // Views of memory owned by the caller.
+        std::vector<fdeep::tensor3s> outputs;
+        for (const auto& inputs : multi_inputs)
+        {
+            fdeep::tensor3_views views;
+            for (const auto& input : inputs)
+            {
+                views.push_back(fdeep::tensor3_view(
+                    input.as_vector()->data(), input.shape()));
+            }
+            outputs.push_back(model.predict(views));
+        }
+        return outputs;
+    });
+}
+
+TEST_CASE("test_model_small_test, predict_into")
+{
+    const auto model = fdeep::load_model("../test_model_small.json", false);
+    check_against_sequential(model,
+        [&](const std::vector<fdeep::tensor3s>& multi_inputs)
+    {
+        std::vector<fdeep::tensor3s> outputs;
+        for (const auto& inputs : multi_inputs)
+        {
+            std::vector<fdeep::float_vec> buffers;
+            std::vector<fdeep::float_type*> destinations;
+            for (const auto& shape : model.get_output_shapes())
+            {
+                buffers.push_back(fdeep::float_vec(shape.volume()));
+                destinations.push_back(buffers.back().data());
+            }
+            model.predict_into(inputs, destinations);
+            fdeep::tensor3s results;
+            for (std::size_t i = 0; i < buffers.size(); ++i)
+            {
+                results.push_back(fdeep::tensor3(
+                    fdeep::internal::storage_order_tag(),
+                    model.get_output_shapes()[i], std::move(buffers[i])));
+            }
+            outputs.push_back(results);
+        }
+        return outputs;
+    });
+}
+
+TEST_CASE("test_model_small_test, buffer_pool")
+{
+    const auto model = fdeep::load_model("../test_model_small.json", false);
+    REQUIRE(fdeep::get_buffer_pool_stats().retained_bytes_ == 0);
+    check_against_sequential(model,
+        [&](const std::vector<fdeep::tensor3s>& multi_inputs)
+    {
+        fdeep::set_buffer_pool_limit(64 * 1024 * 1024);
+        model.predict(multi_inputs.front());
+        const auto before = fdeep::get_buffer_pool_stats();
+        model.predict(multi_inputs.front());
+        const auto after = fdeep::get_buffer_pool_stats();
+        REQUIRE(after.misses_ == before.misses_);
+        REQUIRE(after.hits_ > before.hits_);
+        REQUIRE(after.retained_bytes_ > 0);
+        const auto outputs = model.predict_multi(multi_inputs, false);
+        fdeep::set_buffer_pool_limit(0);
+        REQUIRE(fdeep::get_buffer_pool_stats().retained_bytes_ == 0);
+        return outputs;
+    });
+}
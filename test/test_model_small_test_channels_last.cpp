@@ -0,0 +1,48 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#ifndef FDEEP_CHANNELS_LAST
+#define FDEEP_CHANNELS_LAST
+#endif
+#include <fdeep/fdeep.hpp>
+
+TEST_CASE("test_model_small_test_channels_last, load_model")
+{
+    const auto model = fdeep::load_model("../test_model_small.json",
+        true, fdeep::cout_logger, static_cast<fdeep::float_type>(0.00001));
+    const auto multi_inputs = fplus::generate<std::vector<fdeep::tensor3s>>(
+        [&]() -> fdeep::tensor3s {return model.generate_dummy_inputs();},
+        10);
+    model.predict_multi(multi_inputs, false);
+    model.predict_batch(multi_inputs);
+}
+
+TEST_CASE("test_model_small_test_channels_last, bytes")
+{
+    const std::vector<std::uint8_t> bytes = {0, 51, 102, 153, 204, 255};
+    const auto t = fdeep::tensor3_from_bytes(bytes.data(), 1, 2, 3);
+    REQUIRE(t.shape() == fdeep::shape3(3, 1, 2));
+    REQUIRE(std::abs(t.get(1, 0, 0) - 0.2) < 0.00001);
+    REQUIRE(std::abs(t.get(0, 0, 1) - 0.6) < 0.00001);
+    REQUIRE(fdeep::tensor3_to_bytes(t) == bytes);
+}
+
+TEST_CASE("test_model_small_test_channels_last, depth_first_constructor")
+{
+    fdeep::float_vec values(24);
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        values[i] = static_cast<fdeep::float_type>(i);
+    }
+    const fdeep::tensor3 t(fdeep::shape3(2, 3, 4), fdeep::float_vec(values));
+    REQUIRE(t.get(1, 2, 3) == values[23]);
+    REQUIRE(t.get(1, 0, 0) == values[12]);
+    REQUIRE(fdeep::internal::depth_first_values(t) == values);
+    REQUIRE((*t.as_vector())[1] == values[12]);
+}
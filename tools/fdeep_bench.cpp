@@ -0,0 +1,268 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+// Measures the latency and throughput of a model given as json file.
+// Usage: fdeep_bench model.json [--iterations n] [--warmup n]
+//     [--threads n] [--batch-size n] [--buffer-pool MiB] [--verify]
+
+#include "fdeep/fdeep.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct bench_options
+{
+    std::string model_path_;
+    std::size_t iterations_;
+    std::size_t warmup_;
+    std::size_t threads_;
+    std::size_t batch_size_;
+    std::size_t buffer_pool_mib_;
+    bool verify_;
+};
+
+void print_usage()
+{
+    std::cerr << "Usage: fdeep_bench model.json [options]\n"
+        << "  --iterations n  measured forward passes (default 100)\n"
+        << "  --warmup n      unmeasured forward passes before (default 10)\n"
+        << "  --threads n     additional threads of the model (default 0)\n"
+        << "  --batch-size n  inputs per forward pass (default 1)\n"
+        << "  --buffer-pool n MiB of freed memory to keep for reuse"
+        << " (default 0)\n"
+        << "  --verify        run the test cases of the model file on load\n";
+}
+
+bench_options parse_options(int argc, char* argv[])
+{
+    bench_options options = {"", 100, 10, 0, 1, 0, false};
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const auto next_number = [&]() -> std::size_t
+        {
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument("missing value for " + arg);
+            }
+            return static_cast<std::size_t>(std::stoul(argv[++i]));
+        };
+        if (arg == "--iterations")
+            options.iterations_ = next_number();
+        else if (arg == "--warmup")
+            options.warmup_ = next_number();
+        else if (arg == "--threads")
+            options.threads_ = next_number();
+        else if (arg == "--batch-size")
+            options.batch_size_ = next_number();
+        else if (arg == "--buffer-pool")
+            options.buffer_pool_mib_ = next_number();
+        else if (arg == "--verify")
+            options.verify_ = true;
+        else if (options.model_path_.empty() && arg.substr(0, 2) != "--")
+            options.model_path_ = arg;
+        else
+            throw std::invalid_argument("unknown argument: " + arg);
+    }
+    if (options.model_path_.empty())
+    {
+        throw std::invalid_argument("no model file given");
+    }
+    if (options.iterations_ == 0 || options.batch_size_ == 0)
+    {
+        throw std::invalid_argument("iterations and batch size must be > 0");
+    }
+    return options;
+}
+
+fdeep::tensor3s random_inputs(const fdeep::model& model, std::mt19937& gen)
+{
+    std::uniform_real_distribution<fdeep::float_type> dist(-1, 1);
+    return fplus::transform([&](const fdeep::shape3& shape) -> fdeep::tensor3
+    {
+        fdeep::float_vec values(shape.volume());
+        for (auto& value : values)
+        {
+            value = dist(gen);
+        }
+        return fdeep::tensor3(shape, std::move(values));
+    }, model.get_input_shapes());
+}
+
+// Nearest-rank percentile of sorted values.
+double percentile(const std::vector<double>& sorted, double p)
+{
+    const std::size_t rank = static_cast<std::size_t>(
+        std::ceil(p / 100 * static_cast<double>(sorted.size())));
+    return sorted[std::max<std::size_t>(rank, 1) - 1];
+}
+
+// Peak resident set size of the process in bytes, 0 if unknown.
+std::size_t peak_rss()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+std::string show_shapes(const std::vector<fdeep::shape3>& shapes)
+{
+    return fplus::join(std::string(","), fplus::transform(
+        [](const fdeep::shape3& shape) -> std::string
+    {
+        return "(" + std::to_string(shape.depth_) + "," +
+            std::to_string(shape.height_) + "," +
+            std::to_string(shape.width_) + ")";
+    }, shapes));
+}
+
+void print_profile(const fdeep::layer_profiles& profile,
+    std::size_t iterations)
+{
+    const double total = fplus::sum(fplus::transform(
+        [](const fdeep::layer_profile& p) -> double
+    {
+        return p.type_ == "Model" ? 0 : p.seconds_;
+    }, profile));
+    std::cout << "\nper layer (average per forward pass):\n"
+        << std::left << std::setw(32) << "name"
+        << std::setw(22) << "type"
+        << std::right << std::setw(12) << "ms"
+        << std::setw(8) << "%"
+        << std::setw(12) << "MFLOP"
+        << std::setw(12) << "out KiB"
+        << "  output shape\n";
+    for (const auto& p : profile)
+    {
+        const double n = static_cast<double>(iterations);
+        std::cout << std::left << std::setw(32) << p.name_
+            << std::setw(22) << p.type_
+            << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << 1000 * p.seconds_ / n
+            << std::setprecision(1)
+            << std::setw(8) << (total > 0 ? 100 * p.seconds_ / total : 0)
+            << std::setw(12) << static_cast<double>(p.flops_) / n / 1e6
+            << std::setw(12) << static_cast<double>(p.output_bytes_) / n / 1024
+            << "  " << show_shapes(p.output_shapes_) << "\n";
+    }
+}
+
+int run(const bench_options& options)
+{
+    fdeep::set_buffer_pool_limit(options.buffer_pool_mib_ * 1024 * 1024);
+    auto model = fdeep::load_model(options.model_path_, options.verify_,
+        options.verify_ ? fdeep::cout_logger :
+            std::function<void(std::string)>());
+    model.set_parallelism(options.threads_);
+
+    std::mt19937 gen(0);
+    const auto inputs = fplus::generate<std::vector<fdeep::tensor3s>>(
+        [&]() { return random_inputs(model, gen); }, options.batch_size_);
+    const auto forward_pass = [&]()
+    {
+        if (options.batch_size_ == 1)
+            model.predict(inputs.front());
+        else
+            model.predict_batch(inputs);
+    };
+
+    for (std::size_t i = 0; i < options.warmup_; ++i)
+    {
+        forward_pass();
+    }
+
+    // Profiling only adds a stopwatch per layer.
+    model.set_profiling(true);
+    std::vector<double> latencies;
+    latencies.reserve(options.iterations_);
+    const auto pool_before = fdeep::get_buffer_pool_stats();
+    fplus::stopwatch total_stopwatch;
+    for (std::size_t i = 0; i < options.iterations_; ++i)
+    {
+        fplus::stopwatch stopwatch;
+        forward_pass();
+        latencies.push_back(stopwatch.elapsed());
+    }
+    const double total_seconds = total_stopwatch.elapsed();
+    const auto pool_after = fdeep::get_buffer_pool_stats();
+    std::sort(std::begin(latencies), std::end(latencies));
+
+    std::cout << std::fixed << std::setprecision(3)
+        << "model:       " << options.model_path_ << "\n"
+        << "inputs:      " << show_shapes(model.get_input_shapes()) << "\n"
+        << "iterations:  " << options.iterations_
+        << " (warmup " << options.warmup_ << ")\n"
+        << "threads:     " << options.threads_ << " additional\n"
+        << "batch size:  " << options.batch_size_ << "\n"
+        << "latency ms:  p50 " << 1000 * percentile(latencies, 50)
+        << ", p90 " << 1000 * percentile(latencies, 90)
+        << ", p99 " << 1000 * percentile(latencies, 99)
+        << ", max " << 1000 * latencies.back() << "\n"
+        << "throughput:  " << static_cast<double>(
+            options.iterations_ * options.batch_size_) / total_seconds
+        << " inputs/s\n"
+        << "peak RSS:    " << std::setprecision(1)
+        << static_cast<double>(peak_rss()) / (1024 * 1024) << " MiB\n"
+        << "buffer pool: " << pool_after.hits_ - pool_before.hits_
+        << " hits, " << pool_after.misses_ - pool_before.misses_
+        << " misses, " << static_cast<double>(pool_after.retained_bytes_) /
+            (1024 * 1024) << " MiB retained\n";
+
+    print_profile(model.get_profile(), options.iterations_);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bench_options options = {"", 0, 0, 0, 0, 0, false};
+    try
+    {
+        options = parse_options(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << "\n";
+        print_usage();
+        return 2;
+    }
+    try
+    {
+        return run(options);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,575 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+// Writes a model json file with random weights in the format of
+// keras_export/convert_model.py, without the need for Python/Keras.
+// Usage: fdeep_generate_model output.json [--template name]
+//     [--input HxWxC] [--width n] [--blocks n] [--classes n] [--seed n]
+// Templates: vgg, resnet, inception, mobilenet
+
+#include "fdeep/fdeep.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using nlohmann::json;
+
+struct generator_options
+{
+    std::string output_path_;
+    std::string template_;
+    std::size_t height_;
+    std::size_t width_;
+    std::size_t channels_;
+    std::size_t base_filters_;
+    std::size_t blocks_;
+    std::size_t classes_;
+    std::uint32_t seed_;
+};
+
+void print_usage()
+{
+    std::cerr << "Usage: fdeep_generate_model output.json [options]\n"
+        << "  --template name  vgg, resnet, inception or mobilenet"
+        << " (default vgg)\n"
+        << "  --input HxWxC    input shape (default 224x224x3)\n"
+        << "  --width n        filters of the first block (default 32)\n"
+        << "  --blocks n       number of blocks (default 4)\n"
+        << "  --classes n      number of output classes (default 1000)\n"
+        << "  --seed n         seed for the random weights (default 0)\n";
+}
+
+generator_options parse_options(int argc, char* argv[])
+{
+    generator_options options = {"", "vgg", 224, 224, 3, 32, 4, 1000, 0};
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const auto next = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        const auto next_number = [&]() -> std::size_t
+        {
+            return static_cast<std::size_t>(std::stoul(next()));
+        };
+        if (arg == "--template")
+            options.template_ = next();
+        else if (arg == "--input")
+        {
+            const auto dims = fplus::split('x', false, next());
+            if (dims.size() != 3)
+            {
+                throw std::invalid_argument("input shape must be HxWxC");
+            }
+            options.height_ = static_cast<std::size_t>(std::stoul(dims[0]));
+            options.width_ = static_cast<std::size_t>(std::stoul(dims[1]));
+            options.channels_ = static_cast<std::size_t>(std::stoul(dims[2]));
+        }
+        else if (arg == "--width")
+            options.base_filters_ = next_number();
+        else if (arg == "--blocks")
+            options.blocks_ = next_number();
+        else if (arg == "--classes")
+            options.classes_ = next_number();
+        else if (arg == "--seed")
+            options.seed_ = static_cast<std::uint32_t>(next_number());
+        else if (options.output_path_.empty() && arg.substr(0, 2) != "--")
+            options.output_path_ = arg;
+        else
+            throw std::invalid_argument("unknown argument: " + arg);
+    }
+    if (options.output_path_.empty())
+    {
+        throw std::invalid_argument("no output file given");
+    }
+    return options;
+}
+
+// Base64-encoded float32 values, split like convert_model.py does.
+json encode_floats(const std::vector<float>& values)
+{
+    std::vector<std::uint8_t> bytes(values.size() * sizeof(float));
+    std::memcpy(bytes.data(), values.data(), bytes.size());
+    const std::string encoded = fdeep::internal::Base64_encode(bytes);
+    const std::size_t chunk_size = 1024;
+    json result = json::array();
+    for (std::size_t i = 0; i < encoded.size(); i += chunk_size)
+    {
+        result.push_back(encoded.substr(i, chunk_size));
+    }
+    return result;
+}
+
+json pair_json(std::size_t a, std::size_t b)
+{
+    json result = json::array();
+    result.push_back(a);
+    result.push_back(b);
+    return result;
+}
+
+// Builds the architecture and the weights of a functional Keras model.
+// All spatial layers use "same" padding.
+class model_builder
+{
+public:
+    model_builder(const std::string& name, std::uint32_t seed) :
+        name_(name), gen_(seed), layer_count_(0),
+        layers_(json::array()), params_(json::object()),
+        input_layers_(json::array()), inputs_(), shapes_()
+    {
+    }
+
+    std::string input(std::size_t height, std::size_t width,
+        std::size_t channels)
+    {
+        json shape = json::array();
+        shape.push_back(nullptr);
+        shape.push_back(height);
+        shape.push_back(width);
+        shape.push_back(channels);
+        json config = json::object();
+        config["batch_input_shape"] = shape;
+        const auto name = add_layer("InputLayer", "input", config, {},
+            {height, width, channels});
+        input_layers_.push_back(node_json(name));
+        inputs_.push_back(name);
+        return name;
+    }
+
+    std::string conv(const std::string& x, std::size_t filters,
+        std::size_t kernel_size, std::size_t strides,
+        const std::string& activation)
+    {
+        const auto in = shapes_.at(x);
+        json config = spatial_config(kernel_size, strides);
+        config["filters"] = filters;
+        config["dilation_rate"] = pair_json(1, 1);
+        config["use_bias"] = true;
+        config["activation"] = activation;
+        const auto name = add_layer("Conv2D", "conv", config, {x},
+            {strided(in.height_, strides), strided(in.width_, strides),
+            filters});
+        const std::size_t fan_in = kernel_size * kernel_size * in.channels_;
+        params_[name]["weights"] = encode_floats(
+            random_weights(fan_in * filters, fan_in));
+        params_[name]["bias"] = encode_floats(random_values(filters, 0.1f));
+        return name;
+    }
+
+    std::string separable_conv(const std::string& x, std::size_t filters,
+        std::size_t kernel_size, std::size_t strides,
+        const std::string& activation)
+    {
+        const auto in = shapes_.at(x);
+        json config = spatial_config(kernel_size, strides);
+        config["filters"] = filters;
+        config["dilation_rate"] = pair_json(1, 1);
+        config["depth_multiplier"] = 1;
+        config["use_bias"] = true;
+        config["activation"] = activation;
+        const auto name = add_layer("SeparableConv2D", "sepconv", config,
+            {x}, {strided(in.height_, strides), strided(in.width_, strides),
+            filters});
+        const std::size_t area = kernel_size * kernel_size;
+        params_[name]["slice_weights"] = encode_floats(
+            random_weights(area * in.channels_, area));
+        params_[name]["stack_weights"] = encode_floats(
+            random_weights(in.channels_ * filters, in.channels_));
+        params_[name]["bias"] = encode_floats(random_values(filters, 0.1f));
+        return name;
+    }
+
+    std::string batch_norm(const std::string& x)
+    {
+        const std::size_t channels = shapes_.at(x).channels_;
+        json config = json::object();
+        config["axis"] = -1;
+        config["center"] = true;
+        config["scale"] = true;
+        config["epsilon"] = 0.001;
+        const auto name = add_layer("BatchNormalization", "bn", config, {x},
+            shapes_.at(x));
+        params_[name]["moving_mean"] = encode_floats(
+            random_values(channels, 0.1f));
+        params_[name]["moving_variance"] = encode_floats(
+            random_values(channels, 0.5f, 1));
+        params_[name]["gamma"] = encode_floats(
+            random_values(channels, 0.2f, 1));
+        params_[name]["beta"] = encode_floats(random_values(channels, 0.1f));
+        return name;
+    }
+
+    std::string activation(const std::string& x, const std::string& type)
+    {
+        json config = json::object();
+        config["activation"] = type;
+        return add_layer("Activation", "act", config, {x}, shapes_.at(x));
+    }
+
+    std::string pool(const std::string& type, const std::string& x,
+        std::size_t pool_size, std::size_t strides)
+    {
+        const auto in = shapes_.at(x);
+        json config = json::object();
+        config["pool_size"] = pair_json(pool_size, pool_size);
+        config["strides"] = pair_json(strides, strides);
+        config["padding"] = "same";
+        return add_layer(type, "pool", config, {x},
+            {strided(in.height_, strides), strided(in.width_, strides),
+            in.channels_});
+    }
+
+    std::string add(const std::vector<std::string>& xs)
+    {
+        return add_layer("Add", "add", json::object(), xs,
+            shapes_.at(xs.front()));
+    }
+
+    std::string concatenate(const std::vector<std::string>& xs)
+    {
+        auto shape = shapes_.at(xs.front());
+        shape.channels_ = fplus::sum(fplus::transform(
+            [this](const std::string& x) -> std::size_t
+        {
+            return shapes_.at(x).channels_;
+        }, xs));
+        json config = json::object();
+        config["axis"] = -1;
+        return add_layer("Concatenate", "concatenate", config, xs, shape);
+    }
+
+    std::string global_average_pool(const std::string& x)
+    {
+        return add_layer("GlobalAveragePooling2D", "gap", json::object(),
+            {x}, {1, 1, shapes_.at(x).channels_});
+    }
+
+    std::string dense(const std::string& x, std::size_t units,
+        const std::string& activation)
+    {
+        const std::size_t n_in = shapes_.at(x).channels_;
+        json config = json::object();
+        config["units"] = units;
+        config["use_bias"] = true;
+        config["activation"] = activation;
+        const auto name = add_layer("Dense", "dense", config, {x},
+            {1, 1, units});
+        params_[name]["weights"] = encode_floats(
+            random_weights(n_in * units, n_in));
+        params_[name]["bias"] = encode_floats(random_values(units, 0.1f));
+        return name;
+    }
+
+    std::size_t channels(const std::string& x) const
+    {
+        return shapes_.at(x).channels_;
+    }
+
+    // The complete model file for a single output.
+    json model_json(const std::string& output) const
+    {
+        json output_layers = json::array();
+        output_layers.push_back(node_json(output));
+        json config = json::object();
+        config["name"] = name_;
+        config["layers"] = layers_;
+        config["input_layers"] = input_layers_;
+        config["output_layers"] = output_layers;
+        json architecture = json::object();
+        architecture["class_name"] = "Model";
+        architecture["config"] = config;
+
+        json result = json::object();
+        result["architecture"] = architecture;
+        result["trainable_params"] = params_;
+        result["image_data_format"] = "channels_last";
+        result["input_shapes"] = json::array();
+        for (const auto& input : inputs_)
+        {
+            result["input_shapes"].push_back(shape_json(shapes_.at(input)));
+        }
+        result["output_shapes"] = json::array();
+        result["output_shapes"].push_back(shape_json(shapes_.at(output)));
+        // Behavior of the TensorFlow backend regarding asymmetric padding.
+        for (const std::string depth : {"1", "2"})
+        {
+            for (const std::string layer : {"conv2d", "separable_conv2d"})
+            {
+                result[layer + "_valid_offset_depth_" + depth] = false;
+                result[layer + "_same_offset_depth_" + depth] = depth == "2";
+            }
+        }
+        for (const std::string layer : {"max_pooling_2d", "average_pooling_2d"})
+        {
+            result[layer + "_valid_offset"] = false;
+            result[layer + "_same_offset"] = true;
+        }
+        return result;
+    }
+
+private:
+    // Keras channels_last order
+    struct tensor_shape
+    {
+        std::size_t height_;
+        std::size_t width_;
+        std::size_t channels_;
+    };
+
+    static std::size_t strided(std::size_t size, std::size_t strides)
+    {
+        return (size + strides - 1) / strides;
+    }
+
+    static json node_json(const std::string& name)
+    {
+        json result = json::array();
+        result.push_back(name);
+        result.push_back(0);
+        result.push_back(0);
+        return result;
+    }
+
+    // fdeep order (channels first)
+    static json shape_json(const tensor_shape& shape)
+    {
+        json result = json::array();
+        result.push_back(shape.channels_);
+        result.push_back(shape.height_);
+        result.push_back(shape.width_);
+        return result;
+    }
+
+    static json spatial_config(std::size_t kernel_size, std::size_t strides)
+    {
+        json config = json::object();
+        config["kernel_size"] = pair_json(kernel_size, kernel_size);
+        config["strides"] = pair_json(strides, strides);
+        config["padding"] = "same";
+        return config;
+    }
+
+    std::string add_layer(const std::string& class_name,
+        const std::string& prefix, json config,
+        const std::vector<std::string>& inbound, const tensor_shape& shape)
+    {
+        const std::string name = name_ + "_" + prefix + "_" +
+            std::to_string(++layer_count_);
+        config["name"] = name;
+        json nodes = json::array();
+        if (!inbound.empty())
+        {
+            json node = json::array();
+            for (const auto& x : inbound)
+            {
+                json connection = node_json(x);
+                connection.push_back(json::object());
+                node.push_back(connection);
+            }
+            nodes.push_back(node);
+        }
+        json layer = json::object();
+        layer["class_name"] = class_name;
+        layer["name"] = name;
+        layer["config"] = config;
+        layer["inbound_nodes"] = nodes;
+        layers_.push_back(layer);
+        shapes_[name] = shape;
+        return name;
+    }
+
+    std::vector<float> random_values(std::size_t n, float range,
+        float center = 0)
+    {
+        std::uniform_real_distribution<float> dist(
+            center - range, center + range);
+        std::vector<float> result(n);
+        for (auto& value : result)
+        {
+            value = dist(gen_);
+        }
+        return result;
+    }
+
+    // He-uniform initialization keeps the activations in a sane range.
+    std::vector<float> random_weights(std::size_t n, std::size_t fan_in)
+    {
+        return random_values(n, std::sqrt(
+            6.0f / static_cast<float>(std::max<std::size_t>(1, fan_in))));
+    }
+
+    std::string name_;
+    std::mt19937 gen_;
+    std::size_t layer_count_;
+    json layers_;
+    json params_;
+    json input_layers_;
+    std::vector<std::string> inputs_;
+    std::map<std::string, tensor_shape> shapes_;
+};
+
+std::string conv_bn_relu(model_builder& m, const std::string& x,
+    std::size_t filters, std::size_t kernel_size, std::size_t strides)
+{
+    const auto conv = m.conv(x, filters, kernel_size, strides, "linear");
+    return m.activation(m.batch_norm(conv), "relu");
+}
+
+// Stacks of 3x3 convolutions, each block ending with max pooling.
+std::string vgg_body(model_builder& m, std::string x,
+    const generator_options& options)
+{
+    for (std::size_t i = 0; i < options.blocks_; ++i)
+    {
+        const std::size_t filters = options.base_filters_ << i;
+        x = m.conv(x, filters, 3, 1, "relu");
+        x = m.conv(x, filters, 3, 1, "relu");
+        x = m.pool("MaxPooling2D", x, 2, 2);
+    }
+    return x;
+}
+
+// Residual blocks with batch normalization,
+// each one after the first downsampling by 2.
+std::string resnet_body(model_builder& m, std::string x,
+    const generator_options& options)
+{
+    x = conv_bn_relu(m, x, options.base_filters_, 7, 2);
+    x = m.pool("MaxPooling2D", x, 3, 2);
+    for (std::size_t i = 0; i < options.blocks_; ++i)
+    {
+        const std::size_t filters = options.base_filters_ << i;
+        const std::size_t strides = i == 0 ? 1 : 2;
+        auto shortcut = x;
+        if (strides != 1 || m.channels(x) != filters)
+        {
+            shortcut = m.batch_norm(
+                m.conv(x, filters, 1, strides, "linear"));
+        }
+        auto y = conv_bn_relu(m, x, filters, 3, strides);
+        y = m.batch_norm(m.conv(y, filters, 3, 1, "linear"));
+        x = m.activation(m.add({y, shortcut}), "relu");
+    }
+    return x;
+}
+
+// Blocks of parallel 1x1, 3x3, 5x5 and pooling towers,
+// downsampling by 2 after every second one.
+std::string inception_body(model_builder& m, std::string x,
+    const generator_options& options)
+{
+    x = conv_bn_relu(m, x, options.base_filters_, 3, 2);
+    for (std::size_t i = 0; i < options.blocks_; ++i)
+    {
+        const std::size_t f = std::max<std::size_t>(1,
+            (options.base_filters_ << (i / 2)) / 4);
+        const auto t1 = conv_bn_relu(m, x, f, 1, 1);
+        const auto t3 = conv_bn_relu(m, conv_bn_relu(m, x, f, 1, 1),
+            f, 3, 1);
+        const auto t5 = conv_bn_relu(m, conv_bn_relu(m, x, f / 2 + 1, 1, 1),
+            f, 5, 1);
+        const auto tp = conv_bn_relu(m, m.pool("MaxPooling2D", x, 3, 1),
+            f, 1, 1);
+        x = m.concatenate({t1, t3, t5, tp});
+        if (i % 2 == 1)
+        {
+            x = m.pool("MaxPooling2D", x, 3, 2);
+        }
+    }
+    return x;
+}
+
+// Separable convolutions, downsampling by 2 in every block.
+std::string mobilenet_body(model_builder& m, std::string x,
+    const generator_options& options)
+{
+    x = conv_bn_relu(m, x, options.base_filters_, 3, 2);
+    for (std::size_t i = 0; i < options.blocks_; ++i)
+    {
+        const std::size_t filters = options.base_filters_ << (i + 1);
+        x = m.activation(m.batch_norm(
+            m.separable_conv(x, filters, 3, 2, "linear")), "relu");
+        x = m.activation(m.batch_norm(
+            m.separable_conv(x, filters, 3, 1, "linear")), "relu");
+    }
+    return x;
+}
+
+int run(const generator_options& options)
+{
+    const std::map<std::string, std::function<std::string(
+        model_builder&, std::string, const generator_options&)>> bodies = {
+            {"vgg", vgg_body},
+            {"resnet", resnet_body},
+            {"inception", inception_body},
+            {"mobilenet", mobilenet_body}
+        };
+    const auto body = bodies.find(options.template_);
+    if (body == bodies.end())
+    {
+        throw std::invalid_argument("unknown template: " + options.template_);
+    }
+
+    model_builder m(options.template_, options.seed_);
+    const auto input = m.input(
+        options.height_, options.width_, options.channels_);
+    const auto features = body->second(m, input, options);
+    const auto output = m.dense(m.global_average_pool(features),
+        options.classes_, "softmax");
+
+    std::ofstream file(options.output_path_);
+    file << m.model_json(output).dump();
+    if (!file)
+    {
+        throw std::runtime_error("Unable to write: " + options.output_path_);
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    generator_options options = {"", "", 0, 0, 0, 0, 0, 0, 0};
+    try
+    {
+        options = parse_options(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << "\n";
+        print_usage();
+        return 2;
+    }
+    try
+    {
+        return run(options);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+}
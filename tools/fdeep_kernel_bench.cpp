@@ -0,0 +1,376 @@
+// Copyright 2016, Tobias Hermann.
+// https://github.com/Dobiasd/frugally-deep
+// Distributed under the MIT License.
+// (See accompanying LICENSE file or at
+//  https://opensource.org/licenses/MIT)
+
+// Measures the hot kernels in isolation over representative shapes
+// and reports GFLOP/s and GB/s, optionally compared to a baseline.
+// Usage: fdeep_kernel_bench [--quick] [--filter name] [--min-time s]
+//     [--output results.json] [--baseline results.json]
+
+#include "fdeep/fdeep.hpp"
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace fdeep::internal;
+
+struct bench_options
+{
+    bool quick_;
+    std::string filter_;
+    double min_time_;
+    std::string output_path_;
+    std::string baseline_path_;
+};
+
+// One kernel applied to one input shape.
+// flops_ and bytes_ (read and written) are per run.
+struct kernel_case
+{
+    std::string kernel_;
+    std::string params_;
+    double flops_;
+    double bytes_;
+    std::function<void()> run_;
+};
+
+struct kernel_result
+{
+    std::string kernel_;
+    std::string params_;
+    double seconds_;
+    double gflops_;
+    double gbps_;
+};
+
+void print_usage()
+{
+    std::cerr << "Usage: fdeep_kernel_bench [options]\n"
+        << "  --quick            only a few small shapes\n"
+        << "  --filter name      only kernels whose name contains this\n"
+        << "  --min-time s       measuring time per case (default 0.2)\n"
+        << "  --output file      write the results as json\n"
+        << "  --baseline file    compare to results written before\n";
+}
+
+bench_options parse_options(int argc, char* argv[])
+{
+    bench_options options = {false, "", 0.2, "", ""};
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const auto next = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        if (arg == "--quick")
+            options.quick_ = true;
+        else if (arg == "--filter")
+            options.filter_ = next();
+        else if (arg == "--min-time")
+            options.min_time_ = std::stod(next());
+        else if (arg == "--output")
+            options.output_path_ = next();
+        else if (arg == "--baseline")
+            options.baseline_path_ = next();
+        else
+            throw std::invalid_argument("unknown argument: " + arg);
+    }
+    return options;
+}
+
+tensor3 random_tensor3(const shape3& shape, std::mt19937& gen)
+{
+    std::uniform_real_distribution<float_type> dist(-1, 1);
+    float_vec values(shape.volume());
+    for (auto& value : values)
+    {
+        value = dist(gen);
+    }
+    return tensor3(shape, std::move(values));
+}
+
+std::string show_shape(const shape3& shape)
+{
+    return std::to_string(shape.depth_) + "x" +
+        std::to_string(shape.height_) + "x" +
+        std::to_string(shape.width_);
+}
+
+double value_bytes(std::size_t values)
+{
+    return static_cast<double>(values * sizeof(float_type));
+}
+
+// Typical (channels, spatial size) pairs along the depth of common CNNs.
+std::vector<shape3> input_shapes(bool quick)
+{
+    const std::vector<std::pair<std::size_t, std::size_t>> sizes = quick ?
+        std::vector<std::pair<std::size_t, std::size_t>>{
+            {3, 64}, {32, 28}, {128, 14}} :
+        std::vector<std::pair<std::size_t, std::size_t>>{
+            {3, 512}, {3, 224}, {32, 112}, {64, 56}, {128, 56},
+            {256, 28}, {512, 14}, {1024, 14}, {2048, 7}};
+    return fplus::transform(
+        [](const std::pair<std::size_t, std::size_t>& size) -> shape3
+    {
+        return shape3(size.first, size.second, size.second);
+    }, sizes);
+}
+
+std::vector<kernel_case> conv_cases(const shape3& in_shape, std::mt19937& gen)
+{
+    std::vector<kernel_case> result;
+    const std::size_t depth = in_shape.depth_;
+    const std::size_t out_depth = depth < 32 ? 64 : depth;
+    for (const std::size_t k : std::vector<std::size_t>{1, 3, 5, 7})
+    {
+        // Large kernels are not used with many channels.
+        if (k > 3 && depth > 256)
+        {
+            continue;
+        }
+        const shape3 filter_shape(depth, k, k);
+        const auto filters = fplus::generate<filter_vec>([&]() -> filter
+        {
+            return filter(random_tensor3(filter_shape, gen), 0);
+        }, out_depth);
+        const auto filter_mat = std::make_shared<im2col_filter_matrix>(
+            generate_im2col_filter_matrix(filters));
+        const auto input = random_tensor3(in_shape, gen);
+        for (const std::size_t s : std::vector<std::size_t>{1, 2})
+        {
+            const shape2 strides(s, s);
+            const auto out_shape = convolve(strides, padding::same, false,
+                *filter_mat, input).shape();
+            result.push_back({"conv2d",
+                show_shape(in_shape) + " k" + std::to_string(k) +
+                    " s" + std::to_string(s) +
+                    " f" + std::to_string(out_depth),
+                2.0 * static_cast<double>(
+                    out_shape.volume() * filter_shape.volume()),
+                value_bytes(in_shape.volume() + out_shape.volume() +
+                    filter_shape.volume() * out_depth),
+                [filter_mat, input, strides]()
+                {
+                    convolve(strides, padding::same, false,
+                        *filter_mat, input);
+                }});
+        }
+    }
+    return result;
+}
+
+std::vector<kernel_case> pooling_cases(const shape3& in_shape,
+    std::mt19937& gen)
+{
+    std::vector<kernel_case> result;
+    const auto input = random_tensor3(in_shape, gen);
+    for (const std::size_t k : std::vector<std::size_t>{2, 3})
+    {
+        const auto out_shape = max_pool_2d(
+            k, k, 2, 2, padding::same, false, input).shape();
+        const std::string params = show_shape(in_shape) +
+            " k" + std::to_string(k) + " s2";
+        const double flops = static_cast<double>(out_shape.volume() * k * k);
+        const double bytes = value_bytes(in_shape.volume() + out_shape.volume());
+        result.push_back({"max_pool_2d", params, flops, bytes, [input, k]()
+        {
+            max_pool_2d(k, k, 2, 2, padding::same, false, input);
+        }});
+        result.push_back({"average_pool_2d", params, flops, bytes,
+            [input, k]()
+        {
+            average_pool_2d(k, k, 2, 2, padding::same, false, input);
+        }});
+    }
+    return result;
+}
+
+std::vector<kernel_case> elementwise_cases(const shape3& in_shape,
+    std::mt19937& gen)
+{
+    std::vector<kernel_case> result;
+    const auto input = random_tensor3(in_shape, gen);
+    const std::string params = show_shape(in_shape);
+    const double values = static_cast<double>(in_shape.volume());
+    const double bytes = value_bytes(2 * in_shape.volume());
+
+    const float_vec ones(in_shape.depth_, 1);
+    const float_vec zeros(in_shape.depth_, 0);
+    const auto bn = std::make_shared<batch_normalization_layer>(
+        "bn", zeros, ones, zeros, ones, static_cast<float_type>(0.001));
+    result.push_back({"batch_normalization", params, 2 * values, bytes,
+        [bn, input]() { bn->apply({input}); }});
+
+    const auto softmax = std::make_shared<softmax_layer>("softmax");
+    result.push_back({"softmax", params, 3 * values, bytes,
+        [softmax, input]() { softmax->apply({input}); }});
+
+    const auto relu = std::make_shared<relu_layer>("relu");
+    result.push_back({"relu", params, values, bytes,
+        [relu, input]() { relu->apply({input}); }});
+
+    const auto padded_shape = shape3(in_shape.depth_,
+        in_shape.height_ + 2, in_shape.width_ + 2);
+    result.push_back({"pad_tensor3", params + " p1", 0,
+        value_bytes(in_shape.volume() + padded_shape.volume()),
+        [input]() { pad_tensor3(0, 1, 1, 1, 1, input); }});
+
+    const tensor3s halves = {input, input};
+    result.push_back({"concatenate_tensor3s", params + " x2", 0,
+        value_bytes(4 * in_shape.volume()),
+        [halves]() { concatenate_tensor3s(halves); }});
+    return result;
+}
+
+kernel_result measure(const kernel_case& c, double min_time)
+{
+    c.run_();
+    std::size_t runs = 0;
+    fplus::stopwatch stopwatch;
+    do
+    {
+        c.run_();
+        ++runs;
+    } while (stopwatch.elapsed() < min_time);
+    const double seconds = stopwatch.elapsed() / static_cast<double>(runs);
+    return {c.kernel_, c.params_, seconds,
+        c.flops_ / seconds / 1e9, c.bytes_ / seconds / 1e9};
+}
+
+std::string show_json(const std::vector<kernel_result>& results)
+{
+    std::ostringstream out;
+    out << std::setprecision(9) << "{\"results\": [";
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        const auto& r = results[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "{\"kernel\": \"" << r.kernel_ << "\""
+            << ", \"params\": \"" << r.params_ << "\""
+            << ", \"seconds\": " << r.seconds_
+            << ", \"gflops\": " << r.gflops_
+            << ", \"gbps\": " << r.gbps_ << "}";
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+// Seconds per run of the cases in a json file written with --output.
+std::map<std::string, double> load_baseline(const std::string& path)
+{
+    const auto maybe_json_str = fplus::read_text_file_maybe(path)();
+    if (fplus::is_nothing(maybe_json_str))
+    {
+        throw std::runtime_error("Unable to load: " + path);
+    }
+    const auto json = nlohmann::json::parse(maybe_json_str.unsafe_get_just());
+    std::map<std::string, double> result;
+    for (const auto& r : json["results"])
+    {
+        result[r["kernel"].get<std::string>() + " " +
+            r["params"].get<std::string>()] = r["seconds"].get<double>();
+    }
+    return result;
+}
+
+int run(const bench_options& options)
+{
+    const auto baseline = options.baseline_path_.empty() ?
+        std::map<std::string, double>() : load_baseline(options.baseline_path_);
+
+    std::mt19937 gen(0);
+    std::vector<kernel_result> results;
+    std::cout << std::left << std::setw(22) << "kernel"
+        << std::setw(26) << "params" << std::right
+        << std::setw(12) << "ms" << std::setw(10) << "GFLOP/s"
+        << std::setw(10) << "GB/s"
+        << (baseline.empty() ? "" : "   speedup") << "\n";
+    for (const auto& in_shape : input_shapes(options.quick_))
+    {
+        auto cases = conv_cases(in_shape, gen);
+        cases = fplus::append(cases, pooling_cases(in_shape, gen));
+        cases = fplus::append(cases, elementwise_cases(in_shape, gen));
+        for (const auto& c : cases)
+        {
+            if (c.kernel_.find(options.filter_) == std::string::npos)
+            {
+                continue;
+            }
+            const auto result = measure(c, options.min_time_);
+            results.push_back(result);
+            std::cout << std::left << std::setw(22) << result.kernel_
+                << std::setw(26) << result.params_ << std::right
+                << std::fixed << std::setprecision(3)
+                << std::setw(12) << 1000 * result.seconds_
+                << std::setprecision(2)
+                << std::setw(10) << result.gflops_
+                << std::setw(10) << result.gbps_;
+            const auto it = baseline.find(c.kernel_ + " " + c.params_);
+            if (it != baseline.end())
+            {
+                std::cout << std::setw(9) << it->second / result.seconds_
+                    << "x";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    if (!options.output_path_.empty())
+    {
+        std::ofstream file(options.output_path_);
+        file << show_json(results);
+        if (!file)
+        {
+            throw std::runtime_error("Unable to write: " +
+                options.output_path_);
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    bench_options options = {false, "", 0, "", ""};
+    try
+    {
+        options = parse_options(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << "\n";
+        print_usage();
+        return 2;
+    }
+    try
+    {
+        return run(options);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+}